@@ -0,0 +1,329 @@
+#include "capture.h"
+#include <cstring>
+
+namespace {
+
+const char Magic[4] = { 'R', 'C', 'A', 'P' };
+const uint32_t Version = 2u;
+
+/*
+ * FNV-1a
+ * */
+uint32_t Hash( const void* data, std::size_t size ) {
+    const unsigned char* bytes = ( const unsigned char* ) data;
+    uint32_t h = 2166136261u;
+    for ( std::size_t i = 0u; i < size; i++ ) {
+        h = ( h ^ bytes[i] ) * 16777619u;
+    }
+    return h;
+}
+
+template< typename T >
+bool Read( FILE* file, T& value ) {
+    return fread( &value, sizeof( T ), 1, file ) == 1;
+}
+
+/*
+ * the count is checked against the bytes left before the file ends, so that a
+ * corrupt count cannot ask for more memory than the file could hold
+ * */
+template< typename T >
+bool ReadArray( FILE* file, std::vector< T >& values, uint32_t count, long end ) {
+    const long position = ftell( file );
+    if ( position < 0 || count > uint32_t( ( end - position ) / long( sizeof( T ) ) ) ) {
+        return false;
+    }
+    values.resize( count );
+    return count == 0 || fread( &values[0], sizeof( T ), count, file ) == count;
+}
+
+}
+
+CaptureWriter::CaptureWriter()
+:   file_( NULL ),
+    inStatic_( false ),
+    staticWritten_( false ),
+    static_(),
+    buffers_(),
+    bufferHashes_(),
+    meshes_(),
+    meshHashes_()
+    {}
+
+CaptureWriter::~CaptureWriter() {
+    close();
+}
+
+bool CaptureWriter::open( const char* path, int width, int height ) {
+    close();
+    file_ = fopen( path, "wb" );
+    if ( !file_ ) {
+        return false;
+    }
+    const uint32_t header[3] = { Version, uint32_t( width ), uint32_t( height ) };
+    write_( Magic, sizeof( Magic ) );
+    write_( header, sizeof( header ) );
+    return true;
+}
+
+void CaptureWriter::close() {
+    if ( file_ ) {
+        fclose( file_ );
+        file_ = NULL;
+    }
+    inStatic_ = false;
+    staticWritten_ = false;
+    static_.clear();
+    buffers_.clear();
+    bufferHashes_.clear();
+    meshes_.clear();
+    meshHashes_.clear();
+}
+
+void CaptureWriter::draw( const std::vector< Vector4f >& buffer, const Matrix4f* models, std::size_t count, const OrthoCamera& c ) {
+    if ( !file_ || buffer.empty() || count == 0 ) {
+        return;
+    }
+    draw_( 'D', bufferId_( buffer ), models, count, c );
+}
+
+void CaptureWriter::draw( const QuantizedMesh& mesh, const Matrix4f* models, std::size_t count, const OrthoCamera& c ) {
+    if ( !file_ || mesh.positions.empty() || count == 0 ) {
+        return;
+    }
+    draw_( 'Q', meshId_( mesh ), models, count, c );
+}
+
+void CaptureWriter::viewport( int width, int height ) {
+    if ( file_ ) {
+        const uint32_t size[2] = { uint32_t( width ), uint32_t( height ) };
+        write_( "V", 1 );
+        write_( size, sizeof( size ) );
+    }
+}
+
+void CaptureWriter::endFrame() {
+    if ( file_ ) {
+        writeStatic_();
+        write_( "F", 1 );
+        staticWritten_ = false;
+        
+        /*
+         * complete frames reach the disk, even if the program is killed later on
+         * */
+        fflush( file_ );
+    }
+}
+
+void CaptureWriter::beginStatic() {
+    inStatic_ = true;
+    staticWritten_ = false;
+    static_.clear();
+}
+
+void CaptureWriter::endStatic() {
+    inStatic_ = false;
+}
+
+void CaptureWriter::draw_( char tag, uint32_t buffer, const Matrix4f* models, std::size_t count, const OrthoCamera& c ) {
+    if ( inStatic_ ) {
+        StaticDraw draw;
+        draw.tag = tag;
+        draw.buffer = buffer;
+        draw.camera = c;
+        draw.models.assign( models, models + count );
+        static_.push_back( draw );
+        return;
+    }
+    writeStatic_();
+    writeDraw_( tag, buffer, models, count, c );
+}
+
+void CaptureWriter::writeDraw_( char tag, uint32_t buffer, const Matrix4f* models, std::size_t count, const OrthoCamera& c ) {
+    const uint32_t instances = count;
+    write_( &tag, 1 );
+    write_( &buffer, sizeof( buffer ) );
+    write_( &c, sizeof( c ) );
+    write_( &instances, sizeof( instances ) );
+    write_( models, count * sizeof( Matrix4f ) );
+}
+
+/*
+ * the static draws go first in each frame, as they are under everything else drawn
+ * */
+void CaptureWriter::writeStatic_() {
+    if ( staticWritten_ ) {
+        return;
+    }
+    for ( std::size_t i = 0u; i < static_.size(); i++ ) {
+        const StaticDraw& draw = static_[i];
+        writeDraw_( draw.tag, draw.buffer, &draw.models[0], draw.models.size(), draw.camera );
+    }
+    staticWritten_ = true;
+}
+
+uint32_t CaptureWriter::bufferId_( const std::vector< Vector4f >& buffer ) {
+    const std::size_t size = buffer.size() * sizeof( Vector4f );
+    const uint32_t hash = Hash( &buffer[0], size );
+    
+    typedef std::multimap< uint32_t, uint32_t >::const_iterator Iterator;
+    std::pair< Iterator, Iterator > range = bufferHashes_.equal_range( hash );
+    for ( Iterator it = range.first; it != range.second; ++it ) {
+        const std::vector< Vector4f >& other = buffers_[it->second];
+        if ( other.size() == buffer.size() && memcmp( &other[0], &buffer[0], size ) == 0 ) {
+            return it->second;
+        }
+    }
+    
+    const uint32_t id = buffers_.size();
+    const uint32_t vertices = buffer.size();
+    buffers_.push_back( buffer );
+    bufferHashes_.insert( std::make_pair( hash, id ) );
+    write_( "B", 1 );
+    write_( &id, sizeof( id ) );
+    write_( &vertices, sizeof( vertices ) );
+    write_( &buffer[0], size );
+    return id;
+}
+
+uint32_t CaptureWriter::meshId_( const QuantizedMesh& mesh ) {
+    const std::size_t size = mesh.positions.size() * sizeof( uint16_t );
+    const uint32_t hash = Hash( &mesh.positions[0], size );
+    
+    typedef std::multimap< uint32_t, uint32_t >::const_iterator Iterator;
+    std::pair< Iterator, Iterator > range = meshHashes_.equal_range( hash );
+    for ( Iterator it = range.first; it != range.second; ++it ) {
+        const QuantizedMesh& other = meshes_[it->second];
+        if ( other.positions.size() == mesh.positions.size() && 
+             memcmp( &other.lo, &mesh.lo, sizeof( Vector3f ) ) == 0 &&
+             memcmp( &other.step, &mesh.step, sizeof( Vector3f ) ) == 0 &&
+             memcmp( &other.positions[0], &mesh.positions[0], size ) == 0 ) {
+            return it->second;
+        }
+    }
+    
+    const uint32_t id = meshes_.size();
+    const uint32_t vertices = mesh.vertexCount();
+    meshes_.push_back( mesh );
+    meshHashes_.insert( std::make_pair( hash, id ) );
+    write_( "M", 1 );
+    write_( &id, sizeof( id ) );
+    write_( &mesh.lo, sizeof( Vector3f ) );
+    write_( &mesh.step, sizeof( Vector3f ) );
+    write_( &vertices, sizeof( vertices ) );
+    write_( &mesh.positions[0], size );
+    return id;
+}
+
+void CaptureWriter::write_( const void* data, std::size_t size ) {
+    fwrite( data, 1, size, file_ );
+}
+
+bool Capture::load( const char* path ) {
+    FILE* file = fopen( path, "rb" );
+    if ( !file ) {
+        return false;
+    }
+    
+    char magic[4];
+    uint32_t header[3];
+    if ( fread( magic, 1, 4, file ) != 4 || memcmp( magic, Magic, 4 ) != 0 || 
+         fread( header, sizeof( header ), 1, file ) != 1 || header[0] != Version ) {
+        fclose( file );
+        return false;
+    }
+    width = header[1];
+    height = header[2];
+    buffers.clear();
+    meshes.clear();
+    frames.clear();
+    
+    fseek( file, 0, SEEK_END );
+    const long end = ftell( file );
+    fseek( file, sizeof( magic ) + sizeof( header ), SEEK_SET );
+    
+    /*
+     * A capture cut short, by a crash for example, ends in a partial record. Reading
+     * stops at the first record which is incomplete or not understood, and keeps the
+     * frames before it.
+     * */
+    std::size_t frameBuffers = 0u;  // the buffers read by the end of the last complete frame
+    std::size_t frameMeshes = 0u;
+    CapturedFrame frame;
+    frame.viewWidth = width;
+    frame.viewHeight = height;
+    bool ok = true;
+    int tag;
+    while ( ok && ( tag = fgetc( file ) ) != EOF ) {
+        uint32_t id, count;
+        switch ( tag ) {
+            case 'B':
+                ok = Read( file, id ) && Read( file, count ) && id == buffers.size();
+                if ( ok ) {
+                    buffers.push_back( std::vector< Vector4f >() );
+                    ok = ReadArray( file, buffers.back(), count, end );
+                }
+                break;
+            case 'M':
+                ok = Read( file, id ) && id == meshes.size();
+                if ( ok ) {
+                    meshes.push_back( QuantizedMesh() );
+                    QuantizedMesh& mesh = meshes.back();
+                    ok = Read( file, mesh.lo ) && Read( file, mesh.step ) && Read( file, count ) &&
+                         count <= 0xffffffffu / 4u && ReadArray( file, mesh.positions, 4u*count, end );
+                }
+                break;
+            case 'D':
+            case 'Q': {
+                CapturedDraw draw;
+                draw.quantized = tag == 'Q';
+                ok = Read( file, draw.buffer ) && Read( file, draw.camera ) && Read( file, count ) &&
+                     draw.buffer < ( draw.quantized ? meshes.size() : buffers.size() ) && 
+                     ReadArray( file, draw.models, count, end );
+                if ( ok ) {
+                    frame.draws.push_back( draw );
+                }
+                break;
+            }
+            case 'V': {
+                /*
+                 * the rasterizer needs a viewport at least 8 pixels wide, within the render target
+                 * */
+                uint32_t size[2];
+                ok = Read( file, size ) && size[0] >= 8u && size[0] <= uint32_t( width ) && 
+                     size[1] > 0u && size[1] <= uint32_t( height );
+                if ( ok ) {
+                    frame.viewWidth = size[0];
+                    frame.viewHeight = size[1];
+                }
+                break;
+            }
+            case 'F':
+                frames.push_back( frame );
+                frame.draws.clear();
+                frameBuffers = buffers.size();
+                frameMeshes = meshes.size();
+                break;
+            default:
+                ok = false;
+        }
+    }
+    fclose( file );
+    buffers.resize( frameBuffers );
+    meshes.resize( frameMeshes );
+    return true;
+}
+
+void Render( Rasterizer& r, const Capture& capture, const CapturedFrame& frame ) {
+    if ( r.width() != frame.viewWidth || r.height() != frame.viewHeight ) {
+        r.setViewport( frame.viewWidth, frame.viewHeight );
+    }
+    for ( std::size_t i = 0u; i < frame.draws.size(); i++ ) {
+        const CapturedDraw& draw = frame.draws[i];
+        if ( draw.quantized ) {
+            RenderInstanced( r, capture.meshes[draw.buffer], draw.models, draw.camera );
+        } else {
+            RenderInstanced( r, capture.buffers[draw.buffer], draw.models, draw.camera );
+        }
+    }
+}
@@ -0,0 +1,160 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "renderer.h"
+#include "quantized.h"
+#include "vector.h"
+#include "matrix.h"
+#include "int.h"
+#include <cstdio>
+#include <map>
+#include <vector>
+
+/*
+ * Capture file layout. All values are stored in the byte order of the capturing
+ * machine.
+ * 
+ * header:      "RCAP", uint32 version, uint32 width, uint32 height
+ * records:     uint8 tag, followed by
+ *  'B':        uint32 buffer id, uint32 vertex count, vertex count * 4 floats
+ *  'M':        uint32 mesh id, 3 floats bounds minimum, 3 floats step, uint32 vertex count,
+ *              vertex count * 4 uint16
+ *  'D':        uint32 buffer id, 4 floats of OrthoCamera, uint32 instance count, instance count * 16 floats
+ *  'Q':        as 'D', with the id of a quantized mesh instead of a buffer
+ *  'V':        uint32 width, uint32 height, the viewport of the frames which follow
+ *  'F':        nothing, marks the end of a frame
+ * 
+ * Vertex buffers and quantized meshes are deduplicated by content, so each distinct 
+ * one is written once, before the first draw which uses it. Quantized meshes are stored
+ * quantized, so that their draws replay exactly as they rendered. Draws of the static 
+ * layer are repeated at the start of every frame, so that each frame holds everything
+ * it showed. Frames before the first 'V' record use the whole render target.
+ * */
+
+/**
+ * @class CaptureWriter
+ * @file capture.h
+ * @brief Serializes draw calls to a capture file.
+ */
+class CaptureWriter {
+    public:
+        CaptureWriter();
+        ~CaptureWriter();
+        
+        /**
+         * @brief Open the capture file for writing.
+         * @param path
+         * @param width the width of the render target
+         * @param height the height of the render target
+         * @return false if the file could not be opened
+         */
+        bool open( const char* path, int width, int height );
+        
+        void close();
+        
+        /**
+         * @brief Record a draw of the buffer once for each model matrix.
+         */
+        void draw( const std::vector< Vector4f >&, const Matrix4f* models, std::size_t count, const OrthoCamera& );
+        
+        void draw( const QuantizedMesh&, const Matrix4f* models, std::size_t count, const OrthoCamera& );
+        
+        /**
+         * @brief Record the viewport the following frames are rendered into. Called 
+         * between frames, whenever Rasterizer::setViewport() is.
+         */
+        void viewport( int width, int height );
+        
+        /**
+         * @brief Mark the end of the current frame, and flush the file.
+         */
+        void endFrame();
+        
+        /**
+         * @brief Record the draws until endStatic() as the static layer, replacing the
+         * previous one. The static layer is written into every frame, before its other draws.
+         */
+        void beginStatic();
+        
+        void endStatic();
+        
+    private:
+        CaptureWriter( const CaptureWriter& );
+        CaptureWriter& operator=( const CaptureWriter& );
+        
+        struct StaticDraw {
+            char tag;           // 'D' or 'Q'
+            uint32_t buffer;
+            OrthoCamera camera;
+            std::vector< Matrix4f > models;
+        };
+        
+        uint32_t bufferId_( const std::vector< Vector4f >& );
+        uint32_t meshId_( const QuantizedMesh& );
+        void draw_( char tag, uint32_t buffer, const Matrix4f* models, std::size_t count, const OrthoCamera& );
+        void writeDraw_( char tag, uint32_t buffer, const Matrix4f* models, std::size_t count, const OrthoCamera& );
+        void writeStatic_();
+        void write_( const void* data, std::size_t size );
+        
+        FILE* file_;
+        bool inStatic_;
+        bool staticWritten_;    // the static draws were written into the current frame
+        std::vector< StaticDraw > static_;
+        std::vector< std::vector< Vector4f > > buffers_;
+        std::multimap< uint32_t, uint32_t > bufferHashes_;    // content hash -> buffer id
+        std::vector< QuantizedMesh > meshes_;
+        std::multimap< uint32_t, uint32_t > meshHashes_;      // content hash -> mesh id
+};
+
+struct CapturedDraw {
+    bool quantized;
+    uint32_t buffer;    // an index into Capture::meshes if quantized, into Capture::buffers otherwise
+    OrthoCamera camera;
+    std::vector< Matrix4f > models;
+};
+
+struct CapturedFrame {
+    CapturedFrame()
+    :   viewWidth( 0 ),
+        viewHeight( 0 ),
+        draws()
+        {}
+    
+    int viewWidth;
+    int viewHeight;
+    std::vector< CapturedDraw > draws;
+};
+
+/**
+ * @class Capture
+ * @file capture.h
+ * @brief A capture file read back into memory.
+ */
+struct Capture {
+    Capture()
+    :   width( 0 ),
+        height( 0 )
+        {}
+    
+    /**
+     * @brief Read a capture file.
+     * 
+     * Only complete frames are kept, so a capture which ends in a partial record, as
+     * one interrupted while being written does, loads up to its last complete frame.
+     * @return false if the file could not be opened, or is not a capture file
+     */
+    bool load( const char* path );
+    
+    int width;
+    int height;
+    std::vector< std::vector< Vector4f > > buffers;
+    std::vector< QuantizedMesh > meshes;
+    std::vector< CapturedFrame > frames;
+};
+
+/**
+ * @brief Render all the draws of a captured frame, into the viewport it was rendered into.
+ */
+void Render( Rasterizer&, const Capture&, const CapturedFrame& );
+
+#endif
@@ -0,0 +1,162 @@
+#include "drawlist.h"
+#include "assert.h"
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+/*
+ * spread the low 10 bits of v so that there are two zero bits between each of them
+ * */
+uint32_t SpreadBits( uint32_t v ) {
+    v &= 0x3ffu;
+    v = ( v | ( v << 16 ) ) & 0x030000ffu;
+    v = ( v | ( v << 8 ) ) & 0x0300f00fu;
+    v = ( v | ( v << 4 ) ) & 0x030c30c3u;
+    v = ( v | ( v << 2 ) ) & 0x09249249u;
+    return v;
+}
+
+uint32_t Quantize10( float v, float lo, float scale ) {
+    const float q = ( v - lo ) * scale;
+    return q <= 0.0f ? 0u : q >= 1023.0f ? 1023u : uint32_t( q );
+}
+
+Vector3f BoundsCenter( const std::vector< Vector4f >& buffer ) {
+    Vector3f lo( buffer[0] ), hi( buffer[0] );
+    for ( std::size_t i = 1u; i < buffer.size(); i++ ) {
+        lo = Min( lo, Vector3f( buffer[i] ) );
+        hi = Max( hi, Vector3f( buffer[i] ) );
+    }
+    return 0.5f * ( lo + hi );
+}
+
+}
+
+ClusteredMesh BuildClusters( const std::vector< Vector4f >& buffer, std::size_t trianglesPerCluster ) {
+    ASSERT( trianglesPerCluster > 0u, "Clusters must not be empty" );
+    ClusteredMesh mesh;
+    const std::size_t triangles = buffer.size() / 3;
+    if ( triangles == 0u ) {
+        return mesh;
+    }
+
+    /*
+     * quantize the centroids to a 1024^3 grid over their bounds, and interleave
+     * the bits of the cell coordinates into a Morton code
+     * */
+    std::vector< Vector3f > centroids( triangles );
+    for ( std::size_t i = 0u; i < triangles; i++ ) {
+        centroids[i] = ( 1.0f / 3.0f ) * ( Vector3f( buffer[3*i] ) + Vector3f( buffer[3*i+1] ) + Vector3f( buffer[3*i+2] ) );
+    }
+    Vector3f lo( centroids[0] ), hi( centroids[0] );
+    for ( std::size_t i = 1u; i < triangles; i++ ) {
+        lo = Min( lo, centroids[i] );
+        hi = Max( hi, centroids[i] );
+    }
+    const float extent = std::max( std::max( hi.x - lo.x, hi.y - lo.y ), hi.z - lo.z );
+    const float scale = extent > 0.0f ? 1023.0f / extent : 0.0f;
+
+    std::vector< std::pair< uint32_t, uint32_t > > codes( triangles );
+    for ( std::size_t i = 0u; i < triangles; i++ ) {
+        const uint32_t code =
+            ( SpreadBits( Quantize10( centroids[i].x, lo.x, scale ) ) << 2 ) |
+            ( SpreadBits( Quantize10( centroids[i].y, lo.y, scale ) ) << 1 ) |
+            SpreadBits( Quantize10( centroids[i].z, lo.z, scale ) );
+        codes[i] = std::make_pair( code, uint32_t( i ) );
+    }
+    std::sort( codes.begin(), codes.end() );
+
+    for ( std::size_t first = 0u; first < triangles; first += trianglesPerCluster ) {
+        const std::size_t last = std::min( first + trianglesPerCluster, triangles );
+        std::vector< Vector4f > cluster;
+        cluster.reserve( 3*( last - first ) );
+        for ( std::size_t i = first; i < last; i++ ) {
+            const std::size_t t = codes[i].second;
+            cluster.push_back( buffer[3*t] );
+            cluster.push_back( buffer[3*t+1] );
+            cluster.push_back( buffer[3*t+2] );
+        }
+        mesh.centers.push_back( BoundsCenter( cluster ) );
+        mesh.clusters.push_back( cluster );
+    }
+    return mesh;
+}
+
+DrawList::DrawList()
+:   draws_(),
+    keys_(),
+    order_(),
+    scratch_()
+    {}
+
+void DrawList::clear() {
+    draws_.clear();
+}
+
+void DrawList::add( const std::vector< Vector4f >& buffer, const Matrix4f& model ) {
+    if ( buffer.empty() ) {
+        return;
+    }
+    Draw draw;
+    draw.buffer = &buffer;
+    draw.model = model;
+    draw.center = BoundsCenter( buffer );
+    draws_.push_back( draw );
+}
+
+void DrawList::add( const ClusteredMesh& mesh, const Matrix4f& model ) {
+    ASSERT( mesh.clusters.size() == mesh.centers.size(), "Cluster and center counts differ" );
+    for ( std::size_t i = 0u; i < mesh.clusters.size(); i++ ) {
+        Draw draw;
+        draw.buffer = &mesh.clusters[i];
+        draw.model = model;
+        draw.center = mesh.centers[i];
+        draws_.push_back( draw );
+    }
+}
+
+void DrawList::submit( Rasterizer& r, const OrthoCamera& c ) {
+    const std::size_t count = draws_.size();
+    if ( count == 0u ) {
+        return;
+    }
+
+    /*
+     * the key is the NDC depth of the draw's center, mapped from [-1, 1] to 16 bits,
+     * so that nearer draws have smaller keys
+     * */
+    const Matrix4f projection = OrthoProjection( c );
+    keys_.resize( count );
+    order_.resize( count );
+    scratch_.resize( count );
+    for ( std::size_t i = 0u; i < count; i++ ) {
+        const Draw& d = draws_[i];
+        const Vector4f p = projection * ( d.model * Vector4f( d.center.x, d.center.y, d.center.z, 1.0f ) );
+        const float z = 0.5f * ( p.z + 1.0f ) * 65535.0f;
+        keys_[i] = z <= 0.0f ? 0u : z >= 65535.0f ? 65535u : uint16_t( z );
+        order_[i] = uint32_t( i );
+    }
+
+    /*
+     * a stable least significant digit radix sort, one byte per pass
+     * */
+    for ( int shift = 0; shift < 16; shift += 8 ) {
+        std::size_t offsets[257] = { 0u };
+        for ( std::size_t i = 0u; i < count; i++ ) {
+            offsets[( ( keys_[order_[i]] >> shift ) & 0xff ) + 1]++;
+        }
+        for ( int b = 0; b < 256; b++ ) {
+            offsets[b+1] += offsets[b];
+        }
+        for ( std::size_t i = 0u; i < count; i++ ) {
+            scratch_[offsets[( keys_[order_[i]] >> shift ) & 0xff]++] = order_[i];
+        }
+        order_.swap( scratch_ );
+    }
+
+    for ( std::size_t i = 0u; i < count; i++ ) {
+        const Draw& d = draws_[order_[i]];
+        Render( r, *d.buffer, d.model, c );
+    }
+}
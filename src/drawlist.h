@@ -0,0 +1,82 @@
+#ifndef DRAWLIST_H
+#define DRAWLIST_H
+
+#include "rasterizer.h"
+#include "renderer.h"
+#include "vector.h"
+#include "matrix.h"
+#include "int.h"
+#include <vector>
+
+/**
+ * @class ClusteredMesh
+ * @file drawlist.h
+ * @brief A triangle list split into spatially coherent clusters.
+ *
+ * Each cluster is sorted into the draw list on its own, so the triangles of a large
+ * mesh are drawn roughly front to back for whatever view it is seen from.
+ */
+struct ClusteredMesh {
+    ClusteredMesh()
+    :   clusters(),
+        centers()
+        {}
+
+    std::vector< std::vector< Vector4f > > clusters;
+    std::vector< Vector3f > centers;    // the bounds center of each cluster, in model space
+};
+
+/**
+ * @brief Split a triangle list into clusters of triangles which are close to each other.
+ *
+ * Triangles are ordered along a Morton curve through their centroids, and consecutive runs
+ * of the ordered triangles become clusters.
+ * @param buffer a triangle list
+ * @param trianglesPerCluster the number of triangles in each cluster, except possibly the last
+ */
+ClusteredMesh BuildClusters( const std::vector< Vector4f >& buffer, std::size_t trianglesPerCluster = 64u );
+
+/**
+ * @class DrawList
+ * @file drawlist.h
+ * @brief Collects opaque draws, and submits them front to back.
+ *
+ * Drawing the nearest geometry first lets the depth test reject the pixels of everything
+ * behind it. Draws are sorted by the depth of their bounds center, quantized to 16 bits,
+ * with a radix sort. The buffers are referenced, not copied, and must stay alive until
+ * the list is submitted.
+ */
+class DrawList {
+    public:
+        DrawList();
+
+        void clear();
+
+        void add( const std::vector< Vector4f >& buffer, const Matrix4f& model );
+
+        /**
+         * @brief Add each cluster of the mesh as a draw of its own.
+         */
+        void add( const ClusteredMesh& mesh, const Matrix4f& model );
+
+        /**
+         * @brief Render the draws in front to back order.
+         *
+         * The list is left unchanged, so it can be submitted again.
+         */
+        void submit( Rasterizer&, const OrthoCamera& );
+
+    private:
+        struct Draw {
+            const std::vector< Vector4f >* buffer;
+            Matrix4f model;
+            Vector3f center;
+        };
+
+        std::vector< Draw > draws_;
+        std::vector< uint16_t > keys_;
+        std::vector< uint32_t > order_;
+        std::vector< uint32_t > scratch_;
+};
+
+#endif
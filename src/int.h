@@ -2,8 +2,11 @@
 #define INT_H
 
 #ifdef _MSC_VER
+    typedef unsigned __int16 uint16_t;
     typedef __int32 int32_t;
     typedef unsigned __int32 uint32_t;
+    typedef __int64 int64_t;
+    typedef unsigned __int64 uint64_t;
 #else
     #include <stdint.h>
 #endif
@@ -0,0 +1,451 @@
+#include "lod.h"
+#include "assert.h"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <queue>
+
+namespace {
+
+typedef Vector3< double > Vector3d;
+
+/*
+ * The symmetric 4x4 matrix Q of a quadric error, v^T Q v, stored as its upper triangle:
+ * 
+ * | q[0] q[1] q[2] q[3] |
+ * |      q[4] q[5] q[6] |
+ * |           q[7] q[8] |
+ * |                q[9] |
+ * */
+struct Quadric {
+    Quadric() {
+        for ( int i = 0; i < 10; i++ ) {
+            q[i] = 0.0;
+        }
+    }
+    
+    /*
+     * the squared distance to the plane ax + by + cz + d = 0, scaled by weight
+     * */
+    Quadric( double a, double b, double c, double d, double weight ) {
+        q[0] = weight*a*a; q[1] = weight*a*b; q[2] = weight*a*c; q[3] = weight*a*d;
+        q[4] = weight*b*b; q[5] = weight*b*c; q[6] = weight*b*d;
+        q[7] = weight*c*c; q[8] = weight*c*d;
+        q[9] = weight*d*d;
+    }
+    
+    Quadric& operator+=( const Quadric& rhs ) {
+        for ( int i = 0; i < 10; i++ ) {
+            q[i] += rhs.q[i];
+        }
+        return *this;
+    }
+    
+    double error( const Vector3d& v ) const {
+        return    q[0]*v.x*v.x + 2.0*q[1]*v.x*v.y + 2.0*q[2]*v.x*v.z + 2.0*q[3]*v.x
+                + q[4]*v.y*v.y + 2.0*q[5]*v.y*v.z + 2.0*q[6]*v.y
+                + q[7]*v.z*v.z + 2.0*q[8]*v.z
+                + q[9];
+    }
+    
+    /*
+     * find the point of minimum error by solving the 3x3 system given by the
+     * gradient, using Cramer's rule. Returns false if the system is singular.
+     * */
+    bool minimum( Vector3d& v ) const {
+        const double det = 
+              q[0]*( q[4]*q[7] - q[5]*q[5] ) 
+            - q[1]*( q[1]*q[7] - q[5]*q[2] ) 
+            + q[2]*( q[1]*q[5] - q[4]*q[2] );
+        if ( std::fabs( det ) < 1e-12 ) {
+            return false;
+        }
+        const double bx = -q[3], by = -q[6], bz = -q[8];
+        v.x = ( bx*( q[4]*q[7] - q[5]*q[5] ) - q[1]*( by*q[7] - q[5]*bz ) + q[2]*( by*q[5] - q[4]*bz ) ) / det;
+        v.y = ( q[0]*( by*q[7] - bz*q[5] ) - bx*( q[1]*q[7] - q[5]*q[2] ) + q[2]*( q[1]*bz - by*q[2] ) ) / det;
+        v.z = ( q[0]*( q[4]*bz - q[5]*by ) - q[1]*( q[1]*bz - by*q[2] ) + bx*( q[1]*q[5] - q[4]*q[2] ) ) / det;
+        return true;
+    }
+    
+    double q[10];
+};
+
+/*
+ * open boundaries are held in place by planes through the boundary edges, 
+ * perpendicular to the face, with this weight
+ * */
+const double BoundaryWeight = 1000.0;
+
+struct Collapse {
+    double cost;
+    int v0, v1;
+    int version0, version1;
+    Vector3d position;
+    
+    // reversed, so that the priority queue returns the cheapest collapse first
+    bool operator<( const Collapse& rhs ) const {
+        return cost > rhs.cost;
+    }
+};
+
+struct PositionLess {
+    bool operator()( const Vector4f& a, const Vector4f& b ) const {
+        if ( a.x != b.x ) return a.x < b.x;
+        if ( a.y != b.y ) return a.y < b.y;
+        return a.z < b.z;
+    }
+};
+
+class Simplifier {
+    public:
+        explicit Simplifier( const std::vector< Vector4f >& buffer );
+        
+        void run( std::size_t targetTriangles );
+        std::vector< Vector4f > result() const;
+        
+    private:
+        Vector3d normal_( int triangle ) const;
+        bool contains_( int triangle, int v ) const;
+        bool flips_( int v, int other, const Vector3d& position ) const;
+        void push_( int v0, int v1 );
+        
+        std::vector< Vector3d > positions_;
+        std::vector< Quadric > quadrics_;
+        std::vector< int > versions_;
+        std::vector< bool > removedVertices_;
+        std::vector< int > triangles_;                  // three vertex indices per triangle
+        std::vector< bool > removedTriangles_;
+        std::vector< std::vector< int > > adjacency_;   // vertex -> triangles
+        std::priority_queue< Collapse > queue_;
+        std::size_t triangleCount_;
+};
+
+Simplifier::Simplifier( const std::vector< Vector4f >& buffer )
+:   triangleCount_( 0u ) {
+    /*
+     * weld vertices with identical positions
+     * */
+    std::map< Vector4f, int, PositionLess > welded;
+    for ( std::size_t i = 0u; i + 2 < buffer.size(); i += 3 ) {
+        int v[3];
+        for ( int k = 0; k < 3; k++ ) {
+            std::map< Vector4f, int, PositionLess >::iterator it = welded.find( buffer[i+k] );
+            if ( it == welded.end() ) {
+                it = welded.insert( std::make_pair( buffer[i+k], int( positions_.size() ) ) ).first;
+                positions_.push_back( Vector3d( buffer[i+k].x, buffer[i+k].y, buffer[i+k].z ) );
+            }
+            v[k] = it->second;
+        }
+        if ( v[0] != v[1] && v[1] != v[2] && v[2] != v[0] ) {
+            triangles_.push_back( v[0] );
+            triangles_.push_back( v[1] );
+            triangles_.push_back( v[2] );
+        }
+    }
+    
+    const int vertexCount = positions_.size();
+    triangleCount_ = triangles_.size() / 3;
+    quadrics_.resize( vertexCount );
+    versions_.resize( vertexCount, 0 );
+    removedVertices_.resize( vertexCount, false );
+    removedTriangles_.resize( triangleCount_, false );
+    adjacency_.resize( vertexCount );
+    
+    /*
+     * accumulate the area-weighted face planes, and count the faces of each edge
+     * */
+    std::map< std::pair< int, int >, int > edgeFaces;
+    for ( std::size_t t = 0u; t < triangleCount_; t++ ) {
+        const Vector3d n = normal_( t );
+        const double length = n.norm();
+        for ( int k = 0; k < 3; k++ ) {
+            const int v0 = triangles_[3*t + k];
+            const int v1 = triangles_[3*t + ( k + 1 ) % 3];
+            adjacency_[v0].push_back( t );
+            edgeFaces[ std::make_pair( std::min( v0, v1 ), std::max( v0, v1 ) ) ]++;
+        }
+        if ( length == 0.0 ) {
+            continue;
+        }
+        const Vector3d unit = ( 1.0 / length ) * n;
+        const Quadric plane( unit.x, unit.y, unit.z, -unit.dot( positions_[triangles_[3*t]] ), 0.5*length );
+        for ( int k = 0; k < 3; k++ ) {
+            quadrics_[triangles_[3*t + k]] += plane;
+        }
+    }
+    
+    /*
+     * constrain boundary edges with planes perpendicular to their face
+     * */
+    for ( std::size_t t = 0u; t < triangleCount_; t++ ) {
+        const Vector3d n = normal_( t );
+        for ( int k = 0; k < 3; k++ ) {
+            const int v0 = triangles_[3*t + k];
+            const int v1 = triangles_[3*t + ( k + 1 ) % 3];
+            if ( edgeFaces[ std::make_pair( std::min( v0, v1 ), std::max( v0, v1 ) ) ] != 1 ) {
+                continue;
+            }
+            const Vector3d edge = positions_[v1] - positions_[v0];
+            const Vector3d perpendicular = edge.cross( n );
+            const double length = perpendicular.norm();
+            if ( length == 0.0 ) {
+                continue;
+            }
+            const Vector3d unit = ( 1.0 / length ) * perpendicular;
+            const Quadric plane( unit.x, unit.y, unit.z, -unit.dot( positions_[v0] ), BoundaryWeight * edge.squaredLength() );
+            quadrics_[v0] += plane;
+            quadrics_[v1] += plane;
+        }
+    }
+    
+    for ( std::map< std::pair< int, int >, int >::const_iterator it = edgeFaces.begin(); it != edgeFaces.end(); ++it ) {
+        push_( it->first.first, it->first.second );
+    }
+}
+
+void Simplifier::run( std::size_t targetTriangles ) {
+    while ( triangleCount_ > targetTriangles && !queue_.empty() ) {
+        const Collapse c = queue_.top();
+        queue_.pop();
+        
+        /*
+         * entries are left in the queue when their vertices change, and skipped here
+         * */
+        if ( removedVertices_[c.v0] || removedVertices_[c.v1] || 
+             versions_[c.v0] != c.version0 || versions_[c.v1] != c.version1 ) {
+            continue;
+        }
+        if ( flips_( c.v0, c.v1, c.position ) || flips_( c.v1, c.v0, c.position ) ) {
+            continue;
+        }
+        
+        /*
+         * collapse v1 into v0
+         * */
+        positions_[c.v0] = c.position;
+        quadrics_[c.v0] += quadrics_[c.v1];
+        removedVertices_[c.v1] = true;
+        versions_[c.v0]++;
+        
+        const std::vector< int >& faces = adjacency_[c.v1];
+        for ( std::size_t i = 0u; i < faces.size(); i++ ) {
+            const int t = faces[i];
+            if ( removedTriangles_[t] ) {
+                continue;
+            }
+            if ( contains_( t, c.v0 ) ) {
+                removedTriangles_[t] = true;
+                triangleCount_--;
+                continue;
+            }
+            for ( int k = 0; k < 3; k++ ) {
+                if ( triangles_[3*t + k] == c.v1 ) {
+                    triangles_[3*t + k] = c.v0;
+                }
+            }
+            adjacency_[c.v0].push_back( t );
+        }
+        adjacency_[c.v1].clear();
+        
+        /*
+         * drop removed faces from the adjacency of v0, and requeue its edges
+         * */
+        std::vector< int >& merged = adjacency_[c.v0];
+        std::vector< int > live;
+        for ( std::size_t i = 0u; i < merged.size(); i++ ) {
+            if ( !removedTriangles_[merged[i]] ) {
+                live.push_back( merged[i] );
+            }
+        }
+        merged.swap( live );
+        for ( std::size_t i = 0u; i < merged.size(); i++ ) {
+            for ( int k = 0; k < 3; k++ ) {
+                const int v = triangles_[3*merged[i] + k];
+                if ( v != c.v0 ) {
+                    push_( c.v0, v );
+                }
+            }
+        }
+    }
+}
+
+std::vector< Vector4f > Simplifier::result() const {
+    std::vector< Vector4f > buffer;
+    buffer.reserve( 3*triangleCount_ );
+    for ( std::size_t t = 0u; t < removedTriangles_.size(); t++ ) {
+        if ( removedTriangles_[t] ) {
+            continue;
+        }
+        for ( int k = 0; k < 3; k++ ) {
+            const Vector3d& p = positions_[triangles_[3*t + k]];
+            buffer.push_back( Vector4f( p.x, p.y, p.z, 1.0f ) );
+        }
+    }
+    return buffer;
+}
+
+Vector3d Simplifier::normal_( int t ) const {
+    const Vector3d& p0 = positions_[triangles_[3*t]];
+    const Vector3d& p1 = positions_[triangles_[3*t + 1]];
+    const Vector3d& p2 = positions_[triangles_[3*t + 2]];
+    return ( p1 - p0 ).cross( p2 - p0 );
+}
+
+bool Simplifier::contains_( int t, int v ) const {
+    return triangles_[3*t] == v || triangles_[3*t + 1] == v || triangles_[3*t + 2] == v;
+}
+
+/*
+ * would moving v to the position turn over any of its faces which survive the collapse?
+ * */
+bool Simplifier::flips_( int v, int other, const Vector3d& position ) const {
+    const std::vector< int >& faces = adjacency_[v];
+    for ( std::size_t i = 0u; i < faces.size(); i++ ) {
+        const int t = faces[i];
+        if ( removedTriangles_[t] || contains_( t, other ) ) {
+            continue;
+        }
+        Vector3d p[3];
+        for ( int k = 0; k < 3; k++ ) {
+            const int u = triangles_[3*t + k];
+            p[k] = u == v ? position : positions_[u];
+        }
+        const Vector3d after = ( p[1] - p[0] ).cross( p[2] - p[0] );
+        if ( after.dot( normal_( t ) ) <= 0.0 ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void Simplifier::push_( int v0, int v1 ) {
+    Quadric q = quadrics_[v0];
+    q += quadrics_[v1];
+    
+    Collapse c;
+    c.v0 = v0;
+    c.v1 = v1;
+    c.version0 = versions_[v0];
+    c.version1 = versions_[v1];
+    if ( q.minimum( c.position ) ) {
+        c.cost = q.error( c.position );
+    } else {
+        /*
+         * fall back to the best of the end points and the midpoint
+         * */
+        const Vector3d candidates[3] = { 
+            positions_[v0], 
+            positions_[v1], 
+            0.5 * ( positions_[v0] + positions_[v1] ) 
+        };
+        c.position = candidates[0];
+        c.cost = q.error( candidates[0] );
+        for ( int k = 1; k < 3; k++ ) {
+            const double cost = q.error( candidates[k] );
+            if ( cost < c.cost ) {
+                c.cost = cost;
+                c.position = candidates[k];
+            }
+        }
+    }
+    queue_.push( c );
+}
+
+}
+
+std::vector< Vector4f > Simplify( const std::vector< Vector4f >& buffer, std::size_t targetTriangles ) {
+    Simplifier simplifier( buffer );
+    simplifier.run( targetTriangles );
+    return simplifier.result();
+}
+
+LodChain BuildLodChain( const std::vector< Vector4f >& buffer, std::size_t minTriangles ) {
+    LodChain chain;
+    chain.levels.push_back( buffer );
+    if ( buffer.empty() ) {
+        return chain;
+    }
+    
+    /*
+     * bounding sphere around the center of the bounding box
+     * */
+    Vector3f lo( buffer[0] ), hi( buffer[0] );
+    for ( std::size_t i = 1u; i < buffer.size(); i++ ) {
+        lo = Min( lo, Vector3f( buffer[i] ) );
+        hi = Max( hi, Vector3f( buffer[i] ) );
+    }
+    chain.center = 0.5f * ( lo + hi );
+    float radiusSquared = 0.0f;
+    for ( std::size_t i = 0u; i < buffer.size(); i++ ) {
+        radiusSquared = std::max( radiusSquared, ( Vector3f( buffer[i] ) - chain.center ).squaredLength() );
+    }
+    chain.radius = std::sqrt( radiusSquared );
+    
+    /*
+     * each level is simplified from the previous one, and the chain ends when a level
+     * can no longer be reduced meaningfully
+     * */
+    std::size_t triangles = buffer.size() / 3;
+    while ( triangles / 2 >= minTriangles ) {
+        std::vector< Vector4f > level = Simplify( chain.levels.back(), triangles / 2 );
+        const std::size_t count = level.size() / 3;
+        if ( count == 0u || count > triangles - triangles / 4 ) {
+            break;
+        }
+        chain.levels.push_back( level );
+        triangles = count;
+    }
+    return chain;
+}
+
+std::size_t SelectLod( 
+    const LodChain& chain, 
+    const Matrix4f& model, 
+    const OrthoCamera& c, 
+    const Rasterizer& r, 
+    float trianglesPerPixel 
+) {
+    /*
+     * the largest scale of the model matrix, squared, from the lengths of its basis vectors
+     * */
+    const float* m = model.data;
+    const float scaleSquared = std::max( 
+        m[0]*m[0] + m[4]*m[4] + m[8]*m[8], std::max( 
+        m[1]*m[1] + m[5]*m[5] + m[9]*m[9], 
+        m[2]*m[2] + m[6]*m[6] + m[10]*m[10] ) );
+    
+    /*
+     * the projected area of the bounding sphere in pixels. An orthographic projection
+     * does not depend on the distance, only on the camera extents.
+     * */
+    const float pixelsPerUnit = std::min( r.width() / c.width, r.height() / c.height );
+    const float area = 3.14159265f * chain.radius*chain.radius * scaleSquared * pixelsPerUnit*pixelsPerUnit;
+    const float budget = area * trianglesPerPixel;
+    
+    for ( std::size_t i = 0u; i < chain.levels.size(); i++ ) {
+        if ( chain.levels[i].size() / 3 <= budget ) {
+            return i;
+        }
+    }
+    return chain.levels.empty() ? 0u : chain.levels.size() - 1;
+}
+
+void Render( Rasterizer& r, const LodChain& chain, const Matrix4f& model, const OrthoCamera& c ) {
+    if ( chain.levels.empty() ) {
+        return;
+    }
+    Render( r, chain.levels[SelectLod( chain, model, c, r )], model, c );
+}
+
+void RenderInstanced( Rasterizer& r, const LodChain& chain, const std::vector< Matrix4f >& models, const OrthoCamera& c ) {
+    if ( chain.levels.empty() ) {
+        return;
+    }
+    std::vector< std::vector< Matrix4f > > groups( chain.levels.size() );
+    for ( std::size_t i = 0u; i < models.size(); i++ ) {
+        groups[SelectLod( chain, models[i], c, r )].push_back( models[i] );
+    }
+    for ( std::size_t i = 0u; i < groups.size(); i++ ) {
+        RenderInstanced( r, chain.levels[i], groups[i], c );
+    }
+}
@@ -0,0 +1,72 @@
+#ifndef LOD_H
+#define LOD_H
+
+#include "rasterizer.h"
+#include "renderer.h"
+#include "vector.h"
+#include "matrix.h"
+#include <vector>
+
+/**
+ * @class LodChain
+ * @file lod.h
+ * @brief A mesh and its progressively simplified levels of detail.
+ */
+struct LodChain {
+    LodChain()
+    :   levels(),
+        center(),
+        radius( 0.0f )
+        {}
+    
+    std::vector< std::vector< Vector4f > > levels;  // levels[0] is the original mesh
+    Vector3f center;                                // the bounding sphere, in model space
+    float radius;
+};
+
+/**
+ * @brief Simplify a triangle list using quadric error metrics.
+ * 
+ * Vertices with identical positions are welded before simplification, and edges are
+ * collapsed in order of increasing error until the target is reached or no valid
+ * collapse remains. Open boundaries are preserved.
+ * @param buffer a triangle list
+ * @param targetTriangles
+ * @return the simplified triangle list
+ */
+std::vector< Vector4f > Simplify( const std::vector< Vector4f >& buffer, std::size_t targetTriangles );
+
+/**
+ * @brief Build a chain of levels of detail, each with about half the triangles of the previous.
+ * @param buffer a triangle list, used as the most detailed level
+ * @param minTriangles no level with fewer triangles is built
+ */
+LodChain BuildLodChain( const std::vector< Vector4f >& buffer, std::size_t minTriangles = 16u );
+
+/**
+ * @brief Select the most detailed level which has no more triangles than the budget for
+ * the mesh's projected size on the render target.
+ * @param trianglesPerPixel the triangle budget per pixel of projected area
+ * @return an index into the chain's levels
+ */
+std::size_t SelectLod( 
+    const LodChain&, 
+    const Matrix4f& model, 
+    const OrthoCamera&, 
+    const Rasterizer&, 
+    float trianglesPerPixel = 0.5f 
+);
+
+/**
+ * @brief Render the level of detail selected for the model matrix.
+ */
+void Render( Rasterizer&, const LodChain&, const Matrix4f&, const OrthoCamera& );
+
+/**
+ * @brief Render each instance with the level of detail selected for its model matrix.
+ * 
+ * Instances are grouped by level, and each group is drawn with a single RenderInstanced call.
+ */
+void RenderInstanced( Rasterizer&, const LodChain&, const std::vector< Matrix4f >&, const OrthoCamera& );
+
+#endif
@@ -6,15 +6,21 @@
 #include "assert.h"
 #include "rasterizer.h"
 #include "renderer.h"
+#include "capture.h"
+#include "drawlist.h"
+#include "resolution.h"
+#include "trace.h"
 #include "matrix.h"
 #include "quaternion.h"
 #include "int.h"
 #include <stdio.h>
 #include <ctime>
+#include <algorithm>
 #include <cstdlib>
+#include <cstring>
 #include <vector>
 
-int main(int, char**)
+int main(int argc, char** argv)
 {
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
     {
@@ -43,6 +49,47 @@ int main(int, char**)
      * */
      Rasterizer rasterizer( SDL_GetWindowSurface( window ) );
     
+    /*
+     * record the draw calls to a file when started with --capture <file>
+     * */
+    CaptureWriter capture;
+    for ( int i = 1; i + 1 < argc; i++ ) {
+        if ( strcmp( argv[i], "--capture" ) == 0 ) {
+            if ( !capture.open( argv[i+1], windowSurface->w, windowSurface->h ) ) {
+                printf("Could not open capture file %s.\n", argv[i+1]);
+                SDL_DestroyWindow(window);
+                return 3;
+            }
+            SetCapture( &capture );
+        }
+    }
+    
+    /*
+     * lower the render resolution when frames take longer than --budget <milliseconds>
+     * */
+    float budget = 16.0f;
+    for ( int i = 1; i + 1 < argc; i++ ) {
+        if ( strcmp( argv[i], "--budget" ) == 0 ) {
+            budget = atof( argv[i+1] );
+        }
+    }
+    ResolutionController resolution( budget );
+    
+    /*
+     * write the last --trace-frames <count> frames as a Chrome trace to --trace <file> on exit,
+     * when built with ENABLE_TRACE
+     * */
+    const char* tracePath = NULL;
+    int traceFrames = 60;
+    for ( int i = 1; i + 1 < argc; i++ ) {
+        if ( strcmp( argv[i], "--trace" ) == 0 ) {
+            tracePath = argv[i+1];
+        } else if ( strcmp( argv[i], "--trace-frames" ) == 0 ) {
+            traceFrames = atoi( argv[i+1] );
+        }
+    }
+    const double ticksPerMs = 0.001 * SDL_GetPerformanceFrequency();
+    
     /*
      * create triangle instance
      * */
@@ -69,6 +116,11 @@ int main(int, char**)
         0.0f, 0.0f, 1.0f, -6.0f, 
         0.0f, 0.0f, 0.0f, 1.0f 
     );
+    // remember, model2 translates the triangle instance deeper into the scene (further down -z)
+    const Matrix4f staticModel = model2 * Quatf( 0.0f, 0.0f, sin(0.2f), cos(0.2f) ).asMatrix();
+    bool staticDrawn = false;
+    DrawList drawList;
+    std::vector< SDL_Rect > dirtyRects;
     OrthoCamera camera;
     camera.near = 0.0f;
     camera.far = 8.0f;
@@ -82,6 +134,7 @@ int main(int, char**)
     bool quit = false;
     while (!quit) 
     {
+        TRACE_FRAME();
         SDL_Event event;
         while (SDL_PollEvent(&event))  
         {
@@ -94,37 +147,70 @@ int main(int, char**)
         float dt = 0.001f * ( currentTime - lastTime );
         lastTime = currentTime;
         
+        const Uint64 frameStart = SDL_GetPerformanceCounter();
         if (!SDL_LockSurface(windowSurface))
         {   
             /*
-             * clear the screen here
+             * the triangle which does not move is drawn once, into the static layer.
+             * Each frame then only clears the tiles the moving triangle drew to.
              * */
-            unsigned char* pixels = (unsigned char*) windowSurface->pixels;
-            for ( int i = 0; i < windowSurface->h; i++ ) {
-                uint32_t* p = ( uint32_t* ) pixels;
-                for ( int j = 0; j < windowSurface->w; j+= 4 ) {
-                    *p++ = SDL_MapRGB( windowSurface->format, 0, 0, 0 );
-                    *p++ = SDL_MapRGB( windowSurface->format, 0, 0, 0 );
-                    *p++ = SDL_MapRGB( windowSurface->format, 0, 0, 0 );
-                    *p++ = SDL_MapRGB( windowSurface->format, 0, 0, 0 );
-                }
-                pixels += windowSurface->pitch;
+            if ( !staticDrawn ) {
+                rasterizer.beginStatic();
+                capture.beginStatic();
+                Render( rasterizer, triangle, staticModel, camera );
+                capture.endStatic();
+                rasterizer.endStatic();
+                staticDrawn = true;
             }
+            rasterizer.beginFrame();
             
             /*
              * render the triangles
              * */
             orientation = orientation * Quatf( sin( dt*angularVelocity ), 0.0f, 0.0f, cos( dt*angularVelocity ) );
-            // remember, model2 translates the triangle instance deeper into the scene (further down -z)
-            Render( rasterizer, triangle, model2 * Quatf( 0.0f, 0.0f, sin(0.2f), cos(0.2f) ).asMatrix(), camera );
-            Render( rasterizer, triangle, model1 * orientation.asMatrix(), camera );  // this is deeper
-            rasterizer.clear();
+            drawList.clear();
+            drawList.add( triangle, model1 * orientation.asMatrix() );
+            drawList.submit( rasterizer, camera );
+            capture.endFrame();
+            rasterizer.upscale();
+            rasterizer.dirtyRects( dirtyRects );
             
             SDL_UnlockSurface(windowSurface);
         }
-        SDL_UpdateWindowSurface(window);
+        
+        /*
+         * present only what changed
+         * */
+        if ( !dirtyRects.empty() ) {
+            TRACE_SCOPE( "present" );
+            SDL_UpdateWindowSurfaceRects( window, &dirtyRects[0], dirtyRects.size() );
+        }
+        
+        /*
+         * The frame time includes the present, which covers the whole window while the
+         * scale is below one. The static layer is drawn at the render resolution, so a 
+         * new scale needs a new one.
+         * */
+        if ( resolution.update( ( SDL_GetPerformanceCounter() - frameStart ) / ticksPerMs ) ) {
+            const int width = std::max( int( resolution.scale()*windowSurface->w / 4.0f + 0.5f )*4, 8 );
+            const int height = std::max( int( resolution.scale()*windowSurface->h + 0.5f ), 1 );
+            rasterizer.setViewport( width, height );
+            capture.viewport( width, height );
+            staticDrawn = false;
+        }
     }
 
+    SetCapture( NULL );
+    if ( tracePath ) {
+        int written;
+        if ( !TraceCompiledIn ) {
+            printf("Tracing is not compiled in, configure with -DENABLE_TRACE=ON.\n");
+        } else if ( !WriteTrace( tracePath, traceFrames, written ) ) {
+            printf("Could not write trace file %s.\n", tracePath);
+        } else if ( written < traceFrames ) {
+            printf("Wrote the last %d frames to %s, older frames were not recorded or were overwritten.\n", written, tracePath);
+        }
+    }
     SDL_DestroyWindow(window);
     SDL_Quit();
     return 0;
@@ -0,0 +1,187 @@
+#include "multiview.h"
+#include "transform.h"
+#include "trace.h"
+#include "assert.h"
+#ifdef _MSC_VER
+#   include <SDL_thread.h>
+#   include <SDL_cpuinfo.h>
+#else
+#   include <SDL2/SDL_thread.h>
+#   include <SDL2/SDL_cpuinfo.h>
+#endif
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/*
+ * A triangle can only cover pixels of the render target if it is inside the planes
+ * x = -w and x = w, and y = -w and y = w, in clip space. Each plane is widened by two 
+ * pixels to cover the rounding of the bounding box in the rasterizer.
+ * */
+inline bool OffScreen( const Vector4f& v0, const Vector4f& v1, const Vector4f& v2, float marginX, float marginY ) {
+    const float sx0 = ( 1.0f + marginX )*v0.w, sx1 = ( 1.0f + marginX )*v1.w, sx2 = ( 1.0f + marginX )*v2.w;
+    const float sy0 = ( 1.0f + marginY )*v0.w, sy1 = ( 1.0f + marginY )*v1.w, sy2 = ( 1.0f + marginY )*v2.w;
+    return ( v0.x < -sx0 && v1.x < -sx1 && v2.x < -sx2 ) ||
+           ( v0.x > sx0 && v1.x > sx1 && v2.x > sx2 ) ||
+           ( v0.y < -sy0 && v1.y < -sy1 && v2.y < -sy2 ) ||
+           ( v0.y > sy0 && v1.y > sy1 && v2.y > sy2 );
+}
+
+inline Vector4f Divide( const Vector4f& v ) {
+    const float w = 1.0f / v.w;
+    return Vector4f( v.x*w, v.y*w, v.z*w, 1.0f );
+}
+
+/*
+ * The rasterizer does not clip, so geometry behind a camera would be drawn with a depth
+ * nearer than anything in front of it. Triangles crossing the near plane, z = -w, are cut
+ * at it in clip space, which leaves one or two triangles.
+ * */
+void RasterizeClipped( Rasterizer& r, const Vector4f& v0, const Vector4f& v1, const Vector4f& v2 ) {
+    if ( v0.z >= -v0.w && v1.z >= -v1.w && v2.z >= -v2.w ) {
+        r.rasterize( Divide( v0 ), Divide( v1 ), Divide( v2 ) );
+        return;
+    }
+    const Vector4f* in[3] = { &v0, &v1, &v2 };
+    Vector4f out[4];
+    int n = 0;
+    for ( int i = 0; i < 3; i++ ) {
+        const Vector4f& a = *in[i];
+        const Vector4f& b = *in[( i + 1 ) % 3];
+        const float da = a.z + a.w;
+        const float db = b.z + b.w;
+        if ( da >= 0.0f ) {
+            out[n++] = Divide( a );
+        }
+        if ( ( da >= 0.0f ) != ( db >= 0.0f ) ) {
+            const float t = da / ( da - db );
+            out[n++] = Divide( Vector4f( 
+                a.x + t*( b.x - a.x ), 
+                a.y + t*( b.y - a.y ), 
+                a.z + t*( b.z - a.z ), 
+                a.w + t*( b.w - a.w ) 
+            ) );
+        }
+    }
+    for ( int i = 1; i + 1 < n; i++ ) {
+        r.rasterize( out[0], out[i], out[i+1] );
+    }
+}
+
+}
+
+Matrix4f PerspectiveProjection( float fovY, float aspect, float near, float far ) {
+    const float f = 1.0f / tan( 0.5f*fovY );
+    return Matrix4f(
+        f/aspect,   0.0f,   0.0f,                       0.0f,
+        0.0f,       f,      0.0f,                       0.0f,
+        0.0f,       0.0f,   (far + near)/(near - far),  2.0f*far*near/(near - far),
+        0.0f,       0.0f,   -1.0f,                      0.0f
+    );
+}
+
+MultiViewRenderer::MultiViewRenderer( int threads )
+:   Threads_( threads > 0 ? threads : std::max( SDL_GetCPUCount(), 1 ) ),
+    views_(),
+    draws_(),
+    nextGroup_()
+    {}
+
+void MultiViewRenderer::begin( const std::vector< RenderView >& views ) {
+    for ( std::size_t i = 0u; i < views.size(); i++ ) {
+        ASSERT( views[i].target, "View has no render target" );
+    }
+    views_ = views;
+    draws_.clear();
+}
+
+void MultiViewRenderer::draw( const std::vector< Vector4f >& buffer, const Matrix4f& model, uint32_t objectId ) {
+    if ( buffer.empty() ) {
+        return;
+    }
+    Draw draw;
+    draw.buffer = &buffer;
+    draw.model = model;
+    draw.objectId = objectId;
+    draws_.push_back( draw );
+}
+
+void MultiViewRenderer::end() {
+    /*
+     * the calling thread works too, so one thread fewer is started
+     * */
+    const int groups = int( ( views_.size() + ViewsPerPass - 1 ) / ViewsPerPass );
+    const int threads = std::min( Threads_, groups );
+    SDL_AtomicSet( &nextGroup_, 0 );
+    std::vector< SDL_Thread* > workers;
+    for ( int i = 1; i < threads; i++ ) {
+        SDL_Thread* thread = SDL_CreateThread( workerMain_, "MultiViewRenderer", this );
+        if ( thread ) {
+            workers.push_back( thread );
+        }
+    }
+    work_();
+    for ( std::size_t i = 0u; i < workers.size(); i++ ) {
+        SDL_WaitThread( workers[i], NULL );
+    }
+    
+    /*
+     * the views shade by depth again for anything drawn to them directly
+     * */
+    for ( std::size_t i = 0u; i < views_.size(); i++ ) {
+        views_[i].target->setObjectId( 0u );
+    }
+    draws_.clear();
+}
+
+int MultiViewRenderer::workerMain_( void* renderer ) {
+    static_cast< MultiViewRenderer* >( renderer )->work_();
+    TRACE_THREAD_EXIT();
+    return 0;
+}
+
+void MultiViewRenderer::work_() {
+    std::vector< Matrix4f > transforms;
+    std::vector< Vector4f > transformed;
+    for ( ;; ) {
+        const std::size_t first = std::size_t( SDL_AtomicAdd( &nextGroup_, 1 ) ) * ViewsPerPass;
+        if ( first >= views_.size() ) {
+            break;
+        }
+        TRACE_SCOPE( "view group" );
+        renderGroup_( first, std::min( first + ViewsPerPass, views_.size() ), transforms, transformed );
+    }
+}
+
+void MultiViewRenderer::renderGroup_(
+    std::size_t first,
+    std::size_t last,
+    std::vector< Matrix4f >& transforms,
+    std::vector< Vector4f >& transformed
+) {
+    const std::size_t views = last - first;
+    transforms.resize( views );
+    for ( std::size_t d = 0u; d < draws_.size(); d++ ) {
+        const std::vector< Vector4f >& buffer = *draws_[d].buffer;
+        for ( std::size_t v = 0u; v < views; v++ ) {
+            const RenderView& view = views_[first + v];
+            transforms[v] = view.projection * view.view * draws_[d].model;
+        }
+        transformed.resize( views * buffer.size() );
+        TransformViews( &transforms[0], views, &buffer[0], &transformed[0], buffer.size() );
+
+        for ( std::size_t v = 0u; v < views; v++ ) {
+            Rasterizer& r = *views_[first + v].target;
+            const float marginX = 4.0f / r.width();
+            const float marginY = 4.0f / r.height();
+            const Vector4f* t = &transformed[v * buffer.size()];
+            r.setObjectId( draws_[d].objectId );
+            for ( std::size_t i = 0u; i + 2 < buffer.size(); i += 3 ) {
+                if ( !OffScreen( t[i], t[i+1], t[i+2], marginX, marginY ) ) {
+                    RasterizeClipped( r, t[i], t[i+1], t[i+2] );
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef MULTIVIEW_H
+#define MULTIVIEW_H
+
+#ifdef _MSC_VER
+#   include <SDL_atomic.h>
+#else
+#   include <SDL2/SDL_atomic.h>
+#endif
+#include "rasterizer.h"
+#include "renderer.h"
+#include "vector.h"
+#include "matrix.h"
+#include "int.h"
+#include <vector>
+
+/**
+ * @brief A perspective projection, looking down the negative z axis like OrthoProjection().
+ * 
+ * Perspective needs the division by w, which only MultiViewRenderer does.
+ * @param fovY the vertical field of view, in radians
+ * @param aspect the width of the view divided by its height
+ */
+Matrix4f PerspectiveProjection( float fovY, float aspect, float near, float far );
+
+/**
+ * @class RenderView
+ * @file multiview.h
+ * @brief A camera, and the render target it is rendered to.
+ */
+struct RenderView {
+    RenderView()
+    :   view(),
+        projection(),
+        target( NULL )
+        {}
+
+    Matrix4f view;          // applied after each draw's model matrix
+    Matrix4f projection;    // from OrthoProjection() or PerspectiveProjection()
+    Rasterizer* target;
+};
+
+/**
+ * @class MultiViewRenderer
+ * @file multiview.h
+ * @brief Renders the same draws from many views at once.
+ *
+ * The views are split into groups, and the groups are rendered in parallel. Within a
+ * group, the vertices of each draw are transformed into all of the group's views in one
+ * pass over the buffer, and each view rasterizes only the triangles that can touch its
+ * render target.
+ *
+ * Triangles are clipped against the near plane of each view, and divided by w. Each view
+ * must have a render target of its own. Draws are not recorded by an active capture.
+ */
+class MultiViewRenderer {
+    public:
+        /**
+         * @param threads the number of threads rendering views, or zero for one per CPU
+         */
+        explicit MultiViewRenderer( int threads = 0 );
+
+        /**
+         * @brief Start collecting draws for the views.
+         */
+        void begin( const std::vector< RenderView >& views );
+
+        /**
+         * @brief Add a draw for every view. The buffer is referenced, not copied, and must
+         * stay alive until end() returns.
+         * @param objectId written to the covered pixels instead of the depth shade, unless zero
+         */
+        void draw( const std::vector< Vector4f >& buffer, const Matrix4f& model, uint32_t objectId = 0u );
+
+        /**
+         * @brief Render the collected draws to every view, in the order they were added.
+         * Returns when all views are done, with their object ids reset to zero.
+         */
+        void end();
+
+    private:
+        enum {
+            ViewsPerPass = 8        // the number of views sharing one pass over the vertices
+        };
+
+        struct Draw {
+            const std::vector< Vector4f >* buffer;
+            Matrix4f model;
+            uint32_t objectId;
+        };
+
+        static int workerMain_( void* );
+        void work_();
+        void renderGroup_( std::size_t first, std::size_t last, std::vector< Matrix4f >&, std::vector< Vector4f >& );
+
+        const int Threads_;
+        std::vector< RenderView > views_;
+        std::vector< Draw > draws_;
+        SDL_atomic_t nextGroup_;
+};
+
+#endif
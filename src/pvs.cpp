@@ -0,0 +1,193 @@
+#include "pvs.h"
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+const char Magic[4] = { 'R', 'P', 'V', 'S' };
+const uint32_t Version = 2u;
+
+template< typename T >
+bool Read( FILE* file, T& value ) {
+    return fread( &value, sizeof( T ), 1, file ) == 1;
+}
+
+template< typename T >
+bool Write( FILE* file, const T& value ) {
+    return fwrite( &value, sizeof( T ), 1, file ) == 1;
+}
+
+}
+
+int PvsGrid::cellAt( const Vector3f& p ) const {
+    const float x = floor( ( p.x - lo.x ) / cellSize.x );
+    const float y = floor( ( p.y - lo.y ) / cellSize.y );
+    const float z = floor( ( p.z - lo.z ) / cellSize.z );
+    if ( x < 0.0f || y < 0.0f || z < 0.0f || x >= cells[0] || y >= cells[1] || z >= cells[2] ) {
+        return -1;
+    }
+    return ( int( z )*cells[1] + int( y ) )*cells[0] + int( x );
+}
+
+Vector3f PvsGrid::cellOrigin( int cell ) const {
+    const int x = cell % cells[0];
+    const int y = ( cell / cells[0] ) % cells[1];
+    const int z = cell / ( cells[0]*cells[1] );
+    return Vector3f( lo.x + x*cellSize.x, lo.y + y*cellSize.y, lo.z + z*cellSize.z );
+}
+
+bool PvsGrid::operator==( const PvsGrid& rhs ) const {
+    return lo.x == rhs.lo.x && lo.y == rhs.lo.y && lo.z == rhs.lo.z &&
+           cellSize.x == rhs.cellSize.x && cellSize.y == rhs.cellSize.y && cellSize.z == rhs.cellSize.z &&
+           cells[0] == rhs.cells[0] && cells[1] == rhs.cells[1] && cells[2] == rhs.cells[2] &&
+           objects == rhs.objects && scene == rhs.scene;
+}
+
+std::vector< uint8_t > PackBits( const std::vector< uint8_t >& in ) {
+    std::vector< uint8_t > out;
+    std::size_t i = 0u;
+    while ( i < in.size() ) {
+        std::size_t run = 1u;
+        while ( i + run < in.size() && run < 129u && in[i + run] == in[i] ) {
+            run++;
+        }
+        if ( run >= 3u ) {
+            out.push_back( uint8_t( run + 126u ) );
+            out.push_back( in[i] );
+            i += run;
+            continue;
+        }
+
+        /*
+         * literals last until the next run of at least three bytes, so that packing
+         * never adds more than a byte for every 128
+         * */
+        std::size_t literals = 1u;
+        while ( i + literals < in.size() && literals < 128u &&
+                !( i + literals + 2 < in.size() && in[i + literals] == in[i + literals + 1] && 
+                   in[i + literals] == in[i + literals + 2] ) ) {
+            literals++;
+        }
+        out.push_back( uint8_t( literals - 1u ) );
+        out.insert( out.end(), in.begin() + i, in.begin() + i + literals );
+        i += literals;
+    }
+    return out;
+}
+
+bool UnpackBits( const uint8_t* in, std::size_t size, std::vector< uint8_t >& out ) {
+    std::size_t i = 0u, o = 0u;
+    while ( i < size ) {
+        const uint8_t c = in[i++];
+        if ( c < 128u ) {
+            const std::size_t n = c + 1u;
+            if ( i + n > size || o + n > out.size() ) {
+                return false;
+            }
+            memcpy( &out[o], in + i, n );
+            i += n;
+            o += n;
+        } else {
+            const std::size_t n = c - 126u;
+            if ( i >= size || o + n > out.size() ) {
+                return false;
+            }
+            memset( &out[o], in[i++], n );
+            o += n;
+        }
+    }
+    return o == out.size();
+}
+
+bool WritePvsHeader( FILE* file, const PvsGrid& grid ) {
+    const uint32_t cells[3] = { uint32_t( grid.cells[0] ), uint32_t( grid.cells[1] ), uint32_t( grid.cells[2] ) };
+    return fwrite( Magic, 1, 4, file ) == 4 && Write( file, Version ) &&
+           Write( file, grid.lo ) && Write( file, grid.cellSize ) &&
+           Write( file, cells ) && Write( file, grid.objects ) && Write( file, grid.scene );
+}
+
+bool ReadPvsHeader( FILE* file, PvsGrid& grid ) {
+    char magic[4];
+    uint32_t version, cells[3];
+    if ( fread( magic, 1, 4, file ) != 4 || memcmp( magic, Magic, 4 ) != 0 ||
+         !Read( file, version ) || version != Version ||
+         !Read( file, grid.lo ) || !Read( file, grid.cellSize ) ||
+         !Read( file, cells ) || !Read( file, grid.objects ) || !Read( file, grid.scene ) ) {
+        return false;
+    }
+    
+    /*
+     * the product is taken in 64 bits, where three 32 bit counts cannot overflow it
+     * */
+    const uint64_t count = uint64_t( cells[0] )*cells[1]*cells[2];
+    if ( count == 0u || count > uint64_t( PvsMaxCells ) ) {
+        return false;
+    }
+    for ( int i = 0; i < 3; i++ ) {
+        grid.cells[i] = int( cells[i] );
+    }
+    return true;
+}
+
+bool WritePvsCell( FILE* file, uint32_t cell, const std::vector< uint8_t >& bits ) {
+    const std::vector< uint8_t > packed = PackBits( bits );
+    const uint32_t size = packed.size();
+    return Write( file, cell ) && Write( file, size ) &&
+           ( size == 0u || fwrite( &packed[0], 1, size, file ) == size );
+}
+
+bool ReadPvsCell( FILE* file, const PvsGrid& grid, uint32_t& cell, std::vector< uint8_t >& bits ) {
+    uint32_t size;
+    if ( !Read( file, cell ) || !Read( file, size ) || cell >= uint32_t( grid.cellCount() ) ) {
+        return false;
+    }
+
+    /*
+     * a packed bitset is never more than one control byte per 128 bytes larger than the bitset
+     * */
+    if ( size > grid.bytesPerCell() + grid.bytesPerCell() / 128u + 1u ) {
+        return false;
+    }
+    std::vector< uint8_t > packed( size );
+    if ( size > 0u && fread( &packed[0], 1, size, file ) != size ) {
+        return false;
+    }
+    bits.assign( grid.bytesPerCell(), 0u );
+    return UnpackBits( size > 0u ? &packed[0] : NULL, size, bits );
+}
+
+Pvs::Pvs()
+:   grid_(),
+    bits_(),
+    bakedCells_( 0 )
+    {}
+
+bool Pvs::load( const char* path ) {
+    FILE* file = fopen( path, "rb" );
+    if ( !file ) {
+        return false;
+    }
+    PvsGrid grid;
+    if ( !ReadPvsHeader( file, grid ) ) {
+        fclose( file );
+        return false;
+    }
+    grid_ = grid;
+    bits_.assign( grid_.cellCount()*grid_.bytesPerCell(), 0xffu );
+    bakedCells_ = 0;
+
+    std::vector< bool > baked( grid_.cellCount(), false );
+    uint32_t cell;
+    std::vector< uint8_t > bits;
+    while ( ReadPvsCell( file, grid_, cell, bits ) ) {
+        if ( !bits.empty() ) {
+            memcpy( &bits_[cell*grid_.bytesPerCell()], &bits[0], bits.size() );
+        }
+        if ( !baked[cell] ) {
+            baked[cell] = true;
+            bakedCells_++;
+        }
+    }
+    fclose( file );
+    return true;
+}
@@ -0,0 +1,156 @@
+#ifndef PVS_H
+#define PVS_H
+
+#include "vector.h"
+#include "int.h"
+#include <cstdio>
+#include <vector>
+
+/*
+ * Potentially visible set file layout. All values are stored in the byte order of the
+ * baking machine.
+ *
+ * header:      "RPVS", uint32 version, 3 floats grid minimum, 3 floats cell size,
+ *              3 uint32 cell counts, uint32 object count, uint32 scene hash
+ * records:     uint32 cell index, uint32 packed size, packed size bytes
+ *
+ * Each record is the bitset of the objects visible from one cell, bit i for object i,
+ * compressed with PackBits(). Records are appended in the order cells finish baking, so
+ * a file cut short by an interruption is valid up to its last complete record.
+ * */
+
+/**
+ * @brief The most cells a grid can have, so that cell indices and the size of the
+ * unpacked bitsets stay well within range.
+ */
+const int PvsMaxCells = 1 << 24;
+
+/**
+ * @class PvsGrid
+ * @file pvs.h
+ * @brief The regular grid of view cells a scene is divided into.
+ */
+struct PvsGrid {
+    PvsGrid()
+    :   lo(),
+        cellSize(),
+        objects( 0u ),
+        scene( 0u )
+        {
+            cells[0] = cells[1] = cells[2] = 0;
+        }
+
+    int cellCount() const {
+        return cells[0]*cells[1]*cells[2];
+    }
+
+    std::size_t bytesPerCell() const {
+        return ( objects + 7u ) / 8u;
+    }
+
+    /**
+     * @brief The index of the cell containing a point, or -1 if the point is outside the grid.
+     */
+    int cellAt( const Vector3f& p ) const;
+
+    /**
+     * @brief The minimum corner of a cell.
+     */
+    Vector3f cellOrigin( int cell ) const;
+
+    bool operator==( const PvsGrid& ) const;
+
+    Vector3f lo;
+    Vector3f cellSize;
+    int cells[3];
+    uint32_t objects;
+    uint32_t scene;     // a hash of the objects' vertex buffers and model matrices
+};
+
+/**
+ * @brief Compress a byte string with run length encoding.
+ *
+ * A control byte c below 128 is followed by c + 1 literal bytes, and any other control
+ * byte by a single byte repeated c - 126 times, for runs of 3 to 129 bytes. The long runs
+ * of zero bytes in sparse bitsets pack down to two bytes for every 129.
+ */
+std::vector< uint8_t > PackBits( const std::vector< uint8_t >& );
+
+/**
+ * @brief Decompress a byte string compressed with PackBits().
+ * @param out resized by the caller to the expected decompressed size
+ * @return false unless the input decompresses to exactly out.size() bytes
+ */
+bool UnpackBits( const uint8_t* in, std::size_t size, std::vector< uint8_t >& out );
+
+bool WritePvsHeader( FILE*, const PvsGrid& );
+
+/**
+ * @return false if the file is not a potentially visible set file, or its grid has
+ * more than PvsMaxCells cells
+ */
+bool ReadPvsHeader( FILE*, PvsGrid& );
+
+bool WritePvsCell( FILE*, uint32_t cell, const std::vector< uint8_t >& bits );
+
+/**
+ * @brief Read the next cell record.
+ * @return false at the end of the file, or at a record which is incomplete or not valid
+ * for the grid
+ */
+bool ReadPvsCell( FILE*, const PvsGrid&, uint32_t& cell, std::vector< uint8_t >& bits );
+
+/**
+ * @class Pvs
+ * @file pvs.h
+ * @brief A baked potentially visible set, for culling static objects at runtime.
+ *
+ * Objects are identified by their index, in the order they were given to the baker.
+ * The bitsets are unpacked when loaded, so a lookup is a cell index computation and a
+ * bit test.
+ */
+class Pvs {
+    public:
+        Pvs();
+
+        /**
+         * @brief Read a potentially visible set file. Cells missing from the file, for
+         * example from an interrupted bake, see every object.
+         * @return false if the file could not be read
+         */
+        bool load( const char* path );
+
+        const PvsGrid& grid() const {
+            return grid_;
+        }
+
+        int cellAt( const Vector3f& p ) const {
+            return grid_.cellAt( p );
+        }
+
+        /**
+         * @brief Whether an object may be visible from anywhere in a cell.
+         * @param cell a cell index, or -1 for a point outside the grid, from which
+         * everything is visible
+         */
+        bool visible( int cell, uint32_t object ) const {
+            if ( cell < 0 || object >= grid_.objects ) {
+                return true;
+            }
+            return ( bits_[cell*grid_.bytesPerCell() + ( object >> 3 )] >> ( object & 7u ) ) & 1u;
+        }
+
+        /**
+         * @brief The number of cells which were found in the file.
+         */
+        int bakedCells() const {
+            return bakedCells_;
+        }
+
+    private:
+        PvsGrid grid_;
+        std::vector< uint8_t > bits_;
+        int bakedCells_;
+};
+
+#endif
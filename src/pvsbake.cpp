@@ -0,0 +1,415 @@
+#ifdef _MSC_VER
+#   include <SDL.h>
+#   include <io.h>
+#else
+#   include <SDL2/SDL.h>
+#   include <unistd.h>
+#endif
+#include "capture.h"
+#include "multiview.h"
+#include "pvs.h"
+#include "quantized.h"
+#include "rasterizer.h"
+#include "vector.h"
+#include "matrix.h"
+#include "int.h"
+#include <stdio.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/*
+ * Bakes the potentially visible set of a static scene, headless.
+ *
+ * usage: umbra_pvsbake <capture file> <pvs file> [options]
+ *     --frame n            bake the objects drawn in frame n of the capture, default 0
+ *     --cells x y z        the number of view cells along each axis, default 4 4 4
+ *     --samples n          sample n x n x n points in each cell, default 2
+ *     --size n             render n x n pixel views, default 128
+ *     --threads n          bake cells on n threads, default one per CPU
+ *
+ * Every model matrix of every draw in the frame is an object, numbered in the order
+ * they were drawn. The view cells divide the bounds of the scene. From each sample
+ * point, object ids are rendered in the six axis directions, and every id found in the
+ * images is visible from the cell.
+ *
+ * The six views are 90 degree perspective views, the faces of a cube map around the
+ * sample point.
+ *
+ * If the pvs file already holds cells baked for the same scene and grid, the bake
+ * resumes and only the missing cells are baked.
+ * */
+
+namespace {
+
+struct Object {
+    const std::vector< Vector4f >* buffer;
+    Matrix4f model;
+};
+
+/*
+ * FNV-1a, continued from h
+ * */
+uint32_t Hash( uint32_t h, const void* data, std::size_t size ) {
+    const unsigned char* bytes = ( const unsigned char* ) data;
+    for ( std::size_t i = 0u; i < size; i++ ) {
+        h = ( h ^ bytes[i] ) * 16777619u;
+    }
+    return h;
+}
+
+/*
+ * the view matrix of a camera at p, looking along forward
+ * */
+Matrix4f LookAlong( const Vector3f& p, const Vector3f& forward, const Vector3f& up ) {
+    const Vector3f back( -forward.x, -forward.y, -forward.z );
+    const Vector3f right = up.cross( back );
+    return Matrix4f(
+        right.x,    right.y,    right.z,    -right.dot( p ),
+        up.x,       up.y,       up.z,       -up.dot( p ),
+        back.x,     back.y,     back.z,     -back.dot( p ),
+        0.0f,       0.0f,       0.0f,       1.0f
+    );
+}
+
+struct Baker {
+    Baker()
+    :   objects(),
+        grid(),
+        pending(),
+        samples( 2 ),
+        size( 128 ),
+        radius( 0.0f ),
+        file( NULL ),
+        mutex( NULL ),
+        nextCell(),
+        done( 0 ),
+        failed( false )
+        {}
+
+    std::vector< Object > objects;
+    PvsGrid grid;
+    std::vector< int > pending;     // the cells left to bake
+    int samples;
+    int size;
+    float radius;                   // of the scene bounding sphere
+
+    FILE* file;                     // guarded by mutex
+    SDL_mutex* mutex;
+    SDL_atomic_t nextCell;
+    int done;                       // guarded by mutex
+    bool failed;                    // guarded by mutex
+};
+
+int Bake( void* data ) {
+    Baker& baker = *static_cast< Baker* >( data );
+    const int views = 6 * baker.samples * baker.samples * baker.samples;
+
+    std::vector< SDL_Surface* > surfaces;
+    std::vector< Rasterizer* > rasterizers;
+    for ( int i = 0; i < views; i++ ) {
+        SDL_Surface* surface = SDL_CreateRGBSurface(
+            0, baker.size, baker.size, 32,
+            0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000
+        );
+        if ( !surface ) {
+            break;
+        }
+        surfaces.push_back( surface );
+        rasterizers.push_back( new Rasterizer( surface ) );
+    }
+
+    const Vector3f forward[6] = {
+        Vector3f( 1.0f, 0.0f, 0.0f ), Vector3f( -1.0f, 0.0f, 0.0f ),
+        Vector3f( 0.0f, 1.0f, 0.0f ), Vector3f( 0.0f, -1.0f, 0.0f ),
+        Vector3f( 0.0f, 0.0f, 1.0f ), Vector3f( 0.0f, 0.0f, -1.0f )
+    };
+    const Vector3f up[6] = {
+        Vector3f( 0.0f, 1.0f, 0.0f ), Vector3f( 0.0f, 1.0f, 0.0f ),
+        Vector3f( 0.0f, 0.0f, 1.0f ), Vector3f( 0.0f, 0.0f, 1.0f ),
+        Vector3f( 0.0f, 1.0f, 0.0f ), Vector3f( 0.0f, 1.0f, 0.0f )
+    };
+
+    /*
+     * every point of the scene is within a diameter of the sample point. The near plane
+     * is kept well inside the cell.
+     * */
+    const float near = 0.01f * std::min( std::min( baker.grid.cellSize.x, baker.grid.cellSize.y ), baker.grid.cellSize.z );
+    const Matrix4f projection = PerspectiveProjection( 0.5f*3.14159265f, 1.0f, near, 2.0f * baker.radius );
+
+    MultiViewRenderer renderer( 1 );
+    std::vector< RenderView > renderViews( views );
+    std::vector< uint8_t > bits( baker.grid.bytesPerCell() );
+
+    while ( int( surfaces.size() ) == views ) {
+        const int next = SDL_AtomicAdd( &baker.nextCell, 1 );
+        if ( next >= int( baker.pending.size() ) ) {
+            break;
+        }
+        const int cell = baker.pending[next];
+        const Vector3f origin = baker.grid.cellOrigin( cell );
+
+        int v = 0;
+        for ( int i = 0; i < baker.samples; i++ ) {
+            for ( int j = 0; j < baker.samples; j++ ) {
+                for ( int k = 0; k < baker.samples; k++ ) {
+                    const Vector3f p(
+                        origin.x + baker.grid.cellSize.x * ( k + 0.5f ) / baker.samples,
+                        origin.y + baker.grid.cellSize.y * ( j + 0.5f ) / baker.samples,
+                        origin.z + baker.grid.cellSize.z * ( i + 0.5f ) / baker.samples
+                    );
+                    for ( int f = 0; f < 6; f++, v++ ) {
+                        renderViews[v].view = LookAlong( p, forward[f], up[f] );
+                        renderViews[v].projection = projection;
+                        renderViews[v].target = rasterizers[v];
+                    }
+                }
+            }
+        }
+
+        for ( int i = 0; i < views; i++ ) {
+            memset( surfaces[i]->pixels, 0, surfaces[i]->h * surfaces[i]->pitch );
+            rasterizers[i]->clear();
+        }
+        renderer.begin( renderViews );
+        for ( std::size_t i = 0u; i < baker.objects.size(); i++ ) {
+            renderer.draw( *baker.objects[i].buffer, baker.objects[i].model, uint32_t( i + 1 ) );
+        }
+        renderer.end();
+
+        /*
+         * ids start from one, so that zero is the background
+         * */
+        std::fill( bits.begin(), bits.end(), 0u );
+        for ( int i = 0; i < views; i++ ) {
+            const unsigned char* row = ( const unsigned char* ) surfaces[i]->pixels;
+            for ( int y = 0; y < surfaces[i]->h; y++, row += surfaces[i]->pitch ) {
+                const uint32_t* p = ( const uint32_t* ) row;
+                for ( int x = 0; x < surfaces[i]->w; x++ ) {
+                    if ( p[x] != 0u && p[x] <= baker.objects.size() ) {
+                        bits[( p[x] - 1u ) >> 3] |= uint8_t( 1u << ( ( p[x] - 1u ) & 7u ) );
+                    }
+                }
+            }
+        }
+
+        /*
+         * each record is flushed as soon as it is written, so that an interruption
+         * loses only the cells being baked
+         * */
+        SDL_LockMutex( baker.mutex );
+        if ( WritePvsCell( baker.file, uint32_t( cell ), bits ) && fflush( baker.file ) == 0 ) {
+            baker.done++;
+            printf("\rbaked %d / %d cells", baker.done, int( baker.pending.size() ));
+            fflush( stdout );
+        } else {
+            baker.failed = true;
+        }
+        SDL_UnlockMutex( baker.mutex );
+    }
+
+    for ( std::size_t i = 0u; i < surfaces.size(); i++ ) {
+        delete rasterizers[i];
+        SDL_FreeSurface( surfaces[i] );
+    }
+    return 0;
+}
+
+/*
+ * cut the file off at size bytes
+ * */
+bool Truncate( FILE* file, long size ) {
+#ifdef _MSC_VER
+    return _chsize( _fileno( file ), size ) == 0;
+#else
+    return ftruncate( fileno( file ), size ) == 0;
+#endif
+}
+
+/*
+ * Keep the valid records of an earlier bake of the same grid, and cut off any 
+ * incomplete record at the end, so that new records are appended after them. The
+ * file is changed in place, so that an interruption never loses the cells already
+ * baked.
+ * */
+FILE* OpenJournal( const char* path, const PvsGrid& grid, std::vector< bool >& baked ) {
+    FILE* file = fopen( path, "r+b" );
+    if ( file ) {
+        PvsGrid previous;
+        if ( ReadPvsHeader( file, previous ) && previous == grid ) {
+            long end = ftell( file );
+            uint32_t cell;
+            std::vector< uint8_t > bits;
+            while ( ReadPvsCell( file, grid, cell, bits ) ) {
+                baked[cell] = true;
+                end = ftell( file );
+            }
+            if ( end < 0 || fseek( file, end, SEEK_SET ) != 0 || !Truncate( file, end ) ) {
+                fclose( file );
+                return NULL;
+            }
+            return file;
+        }
+        printf("%s is not a bake of the same scene and grid, starting over.\n", path);
+        fclose( file );
+    }
+
+    file = fopen( path, "wb" );
+    if ( !file ) {
+        return NULL;
+    }
+    if ( !WritePvsHeader( file, grid ) || fflush( file ) != 0 ) {
+        fclose( file );
+        return NULL;
+    }
+    return file;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if ( argc < 3 ) {
+        printf("usage: %s <capture file> <pvs file> [--frame n] [--cells x y z] [--samples n] [--size n] [--threads n]\n", argv[0]);
+        return 1;
+    }
+
+    Baker baker;
+    std::size_t frameIndex = 0u;
+    int cells[3] = { 4, 4, 4 };
+    int threads = std::max( SDL_GetCPUCount(), 1 );
+    for ( int i = 3; i < argc; i++ ) {
+        if ( strcmp( argv[i], "--frame" ) == 0 && i + 1 < argc ) {
+            frameIndex = atoi( argv[++i] );
+        } else if ( strcmp( argv[i], "--cells" ) == 0 && i + 3 < argc ) {
+            for ( int k = 0; k < 3; k++ ) {
+                cells[k] = std::max( atoi( argv[++i] ), 1 );
+            }
+        } else if ( strcmp( argv[i], "--samples" ) == 0 && i + 1 < argc ) {
+            baker.samples = std::max( atoi( argv[++i] ), 1 );
+        } else if ( strcmp( argv[i], "--size" ) == 0 && i + 1 < argc ) {
+            baker.size = std::max( ( atoi( argv[++i] ) + 3 ) / 4 * 4, 8 );
+        } else if ( strcmp( argv[i], "--threads" ) == 0 && i + 1 < argc ) {
+            threads = std::max( atoi( argv[++i] ), 1 );
+        } else {
+            printf("Unknown option %s.\n", argv[i]);
+            return 1;
+        }
+    }
+    if ( uint64_t( cells[0] )*cells[1]*cells[2] > uint64_t( PvsMaxCells ) ) {
+        printf("A grid has at most %d cells.\n", PvsMaxCells);
+        return 1;
+    }
+
+    Capture capture;
+    if ( !capture.load( argv[1] ) ) {
+        printf("Could not read capture file %s.\n", argv[1]);
+        return 2;
+    }
+    if ( frameIndex >= capture.frames.size() ) {
+        printf("The capture has no frame %u.\n", unsigned( frameIndex ));
+        return 2;
+    }
+
+    /*
+     * the objects, the bounds of the scene in world space, and a hash of the scene
+     * which a resumed bake must match
+     * */
+    const CapturedFrame& frame = capture.frames[frameIndex];
+    std::vector< std::vector< Vector4f > > meshBuffers( capture.meshes.size() );   // quantized meshes are baked dequantized
+    for ( std::size_t i = 0u; i < capture.meshes.size(); i++ ) {
+        meshBuffers[i] = Dequantize( capture.meshes[i] );
+    }
+    Vector3f lo( 1e30f, 1e30f, 1e30f ), hi( -1e30f, -1e30f, -1e30f );
+    uint32_t scene = 2166136261u;
+    for ( std::size_t i = 0u; i < frame.draws.size(); i++ ) {
+        const CapturedDraw& draw = frame.draws[i];
+        const std::vector< Vector4f >& buffer = draw.quantized ? meshBuffers[draw.buffer] : capture.buffers[draw.buffer];
+        const uint32_t sizes[2] = { uint32_t( buffer.size() ), uint32_t( draw.models.size() ) };
+        scene = Hash( scene, sizes, sizeof( sizes ) );
+        if ( !buffer.empty() ) {
+            scene = Hash( scene, &buffer[0], buffer.size()*sizeof( Vector4f ) );
+        }
+        if ( !draw.models.empty() ) {
+            scene = Hash( scene, &draw.models[0], draw.models.size()*sizeof( Matrix4f ) );
+        }
+        for ( std::size_t m = 0u; m < draw.models.size(); m++ ) {
+            Object object;
+            object.buffer = &buffer;
+            object.model = draw.models[m];
+            baker.objects.push_back( object );
+            for ( std::size_t k = 0u; k < buffer.size(); k++ ) {
+                const Vector4f p = draw.models[m] * buffer[k];
+                lo = Min( lo, Vector3f( p ) );
+                hi = Max( hi, Vector3f( p ) );
+            }
+        }
+    }
+    if ( baker.objects.empty() ) {
+        printf("Frame %u draws nothing.\n", unsigned( frameIndex ));
+        return 2;
+    }
+
+    /*
+     * flat scenes still get cells of some thickness
+     * */
+    const Vector3f extent = hi - lo;
+    const float minExtent = 1e-3f * std::max( std::max( extent.x, extent.y ), std::max( extent.z, 1.0f ) );
+    baker.grid.lo = lo;
+    baker.grid.cellSize = Vector3f(
+        std::max( extent.x, minExtent ) / cells[0],
+        std::max( extent.y, minExtent ) / cells[1],
+        std::max( extent.z, minExtent ) / cells[2]
+    );
+    baker.grid.cells[0] = cells[0];
+    baker.grid.cells[1] = cells[1];
+    baker.grid.cells[2] = cells[2];
+    baker.grid.objects = baker.objects.size();
+    baker.grid.scene = scene;
+    baker.radius = 0.5f * sqrt( extent.dot( extent ) ) + minExtent;
+
+    std::vector< bool > baked( baker.grid.cellCount(), false );
+    baker.file = OpenJournal( argv[2], baker.grid, baked );
+    if ( !baker.file ) {
+        printf("Could not write pvs file %s.\n", argv[2]);
+        return 3;
+    }
+    for ( int i = 0; i < baker.grid.cellCount(); i++ ) {
+        if ( !baked[i] ) {
+            baker.pending.push_back( i );
+        }
+    }
+    printf("%u objects, %d cells, %d left to bake\n",
+        unsigned( baker.objects.size() ), baker.grid.cellCount(), int( baker.pending.size() ));
+
+    /*
+     * bake the cells in parallel, the calling thread included
+     * */
+    baker.mutex = SDL_CreateMutex();
+    SDL_AtomicSet( &baker.nextCell, 0 );
+    const Uint64 start = SDL_GetPerformanceCounter();
+    std::vector< SDL_Thread* > workers;
+    for ( int i = 1; i < std::min( threads, int( baker.pending.size() ) ); i++ ) {
+        SDL_Thread* thread = SDL_CreateThread( Bake, "PvsBake", &baker );
+        if ( thread ) {
+            workers.push_back( thread );
+        }
+    }
+    Bake( &baker );
+    for ( std::size_t i = 0u; i < workers.size(); i++ ) {
+        SDL_WaitThread( workers[i], NULL );
+    }
+    const double seconds = double( SDL_GetPerformanceCounter() - start ) / SDL_GetPerformanceFrequency();
+    SDL_DestroyMutex( baker.mutex );
+
+    const bool closed = fclose( baker.file ) == 0;
+    const bool ok = closed && !baker.failed && baker.done == int( baker.pending.size() );
+    printf("\n%d cells baked in %.2f s\n", baker.done, seconds);
+    if ( !ok ) {
+        printf("Baking failed, run again to resume.\n");
+        return 4;
+    }
+    return 0;
+}
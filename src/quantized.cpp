@@ -0,0 +1,60 @@
+#include "quantized.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const float Levels = 65535.0f;
+
+uint16_t QuantizeComponent( float x, float lo, float step ) {
+    if ( step == 0.0f ) {
+        return 0u;
+    }
+    const float q = std::floor( ( x - lo ) / step + 0.5f );
+    return uint16_t( std::min( std::max( q, 0.0f ), Levels ) );
+}
+
+}
+
+Matrix4f QuantizedMesh::dequantization() const {
+    return Matrix4f(
+        step.x, 0.0f,   0.0f,   lo.x,
+        0.0f,   step.y, 0.0f,   lo.y,
+        0.0f,   0.0f,   step.z, lo.z,
+        0.0f,   0.0f,   0.0f,   1.0f
+    );
+}
+
+QuantizedMesh Quantize( const std::vector< Vector4f >& buffer ) {
+    QuantizedMesh mesh;
+    if ( buffer.empty() ) {
+        return mesh;
+    }
+    
+    Vector3f lo( buffer[0] ), hi( buffer[0] );
+    for ( std::size_t i = 1u; i < buffer.size(); i++ ) {
+        lo = Min( lo, Vector3f( buffer[i] ) );
+        hi = Max( hi, Vector3f( buffer[i] ) );
+    }
+    mesh.lo = lo;
+    mesh.step = ( 1.0f / Levels ) * ( hi - lo );
+    
+    mesh.positions.resize( 4*buffer.size() );
+    for ( std::size_t i = 0u; i < buffer.size(); i++ ) {
+        mesh.positions[4*i] = QuantizeComponent( buffer[i].x, lo.x, mesh.step.x );
+        mesh.positions[4*i+1] = QuantizeComponent( buffer[i].y, lo.y, mesh.step.y );
+        mesh.positions[4*i+2] = QuantizeComponent( buffer[i].z, lo.z, mesh.step.z );
+        mesh.positions[4*i+3] = 1u;
+    }
+    return mesh;
+}
+
+std::vector< Vector4f > Dequantize( const QuantizedMesh& mesh ) {
+    const Matrix4f m = mesh.dequantization();
+    std::vector< Vector4f > buffer( mesh.vertexCount() );
+    for ( std::size_t i = 0u; i < buffer.size(); i++ ) {
+        const uint16_t* q = &mesh.positions[4*i];
+        buffer[i] = m * Vector4f( q[0], q[1], q[2], q[3] );
+    }
+    return buffer;
+}
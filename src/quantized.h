@@ -0,0 +1,44 @@
+#ifndef QUANTIZED_H
+#define QUANTIZED_H
+
+#include "vector.h"
+#include "matrix.h"
+#include "int.h"
+#include <vector>
+
+/**
+ * @class QuantizedMesh
+ * @file quantized.h
+ * @brief A triangle list with positions quantized to 16 bits per component.
+ * 
+ * Positions are stored relative to the mesh bounds, as four unsigned 16 bit integers 
+ * per vertex: x, y, z, and a w of 1. A vertex takes 8 bytes instead of the 16 bytes
+ * of a Vector4f. The largest error is half a quantization step, 1/131070 of the mesh
+ * extent along each axis.
+ */
+struct QuantizedMesh {
+    QuantizedMesh()
+    :   lo(),
+        step(),
+        positions()
+        {}
+    
+    /**
+     * @brief The matrix which maps quantized positions back to model space.
+     */
+    Matrix4f dequantization() const;
+    
+    std::size_t vertexCount() const {
+        return positions.size() / 4;
+    }
+    
+    Vector3f lo;                        // the minimum corner of the bounds
+    Vector3f step;                      // the size of one quantization step along each axis
+    std::vector< uint16_t > positions;
+};
+
+QuantizedMesh Quantize( const std::vector< Vector4f >& buffer );
+
+std::vector< Vector4f > Dequantize( const QuantizedMesh& );
+
+#endif
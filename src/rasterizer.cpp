@@ -1,10 +1,20 @@
 #include "rasterizer.h"
+#include "simd.h"
+#include "upscale.h"
+#include "trace.h"
 #include "int.h"
 #include <cstdlib>
 #include <cmath>
 #include <algorithm>    // for min, max
 #include <iostream>
 
+namespace {
+
+// the value the depth buffer is cleared to
+const float FarDepth = 100000.0f;
+
+}
+
 struct EdgeEqn {
     public:
         EdgeEqn( const Vector3f& p0, const Vector3f& p1 )
@@ -48,39 +58,118 @@ struct InterpolateVal {
             v0_( v0 ),
             v1_( v1 ),
             v2_( v2 ),
-            InverseArea_( 2.0f / ( (p1 - p0).cross(p2 - p0).norm() ) )
+            InverseArea_( 2.0f / ( (p1 - p0).cross(p2 - p0).norm() ) ),
+            Half_( (p1.x - p0.x)*(p2.y - p0.y) - (p2.x - p0.x)*(p1.y - p0.y) < 0.0f ? -0.5f : 0.5f )
             {}
-            
+        
+        /*
+         * The sub-areas are signed, oriented by the triangle, so that they are positive 
+         * inside it. The value is then linear in x and y, also for pixels which the edge 
+         * equations count as inside, but which lie just outside the exact triangle.
+         * */
         inline float eval( float x, float y ) const {
-            const float A0 = 0.5f*fabs( (p1_.x - x)*(p2_.y - y) - (p2_.x - x)*(p1_.y - y) );
-            const float A1 = 0.5f*fabs( (p2_.x - x)*(p0_.y - y) - (p0_.x - x)*(p2_.y - y) );
-            const float A2 = 0.5f*fabs( (p0_.x - x)*(p1_.y - y) - (p1_.x - x)*(p0_.y - y) );
+            const float A0 = Half_*( (p1_.x - x)*(p2_.y - y) - (p2_.x - x)*(p1_.y - y) );
+            const float A1 = Half_*( (p2_.x - x)*(p0_.y - y) - (p0_.x - x)*(p2_.y - y) );
+            const float A2 = Half_*( (p0_.x - x)*(p1_.y - y) - (p1_.x - x)*(p0_.y - y) );
             
             return InverseArea_*( A0*v0_ + A1*v1_ + A2*v2_ );
         }
         
+        /*
+         * An upper bound of the rounding error of eval() at points within a box of 
+         * width x height around the triangle. Each sub-area is off by a few units in the 
+         * last place of the products it is computed from.
+         * */
+        inline float error( float width, float height ) const {
+            const float v = std::max( std::max( fabs( v0_ ), fabs( v1_ ) ), fabs( v2_ ) );
+            return 1e-6f*v*( 1.0f + InverseArea_*( width + 1.0f )*( height + 1.0f ) );
+        }
+        
     private:
         const Vector3f p0_, p1_, p2_;
         const float v0_, v1_, v2_;
         const float InverseArea_;
+        const float Half_;  // half the sign of the triangle's orientation
+};
+
+/*
+ * Everything about a triangle that the traversal loops need, computed once
+ * in rasterize().
+ * */
+struct TriangleSetup {
+    TriangleSetup( 
+        const EdgeEqn& e0, const EdgeEqn& e1, const EdgeEqn& e2, 
+        const InterpolateVal& depth, float depthError,
+        int minX, int maxX, int minY, int maxY 
+    ):  e0( e0 ),
+        e1( e1 ),
+        e2( e2 ),
+        depth( depth ),
+        depthError( depthError ),
+        minX( minX ),
+        maxX( maxX ),
+        minY( minY ),
+        maxY( maxY )
+        {}
+    
+    const EdgeEqn e0, e1, e2;
+    const InterpolateVal depth;
+    const float depthError;     // the rounding error of depth, within the bounding box
+    const int minX, maxX, minY, maxY;
 };
 
 Rasterizer::Rasterizer( SDL_Surface* surface )
 :   surface_( surface ),
     Width_( surface->w ),
     Height_( surface->h ),
-    zBuffer_( Width_*Height_, 100000.0f )
-    {}
+    viewWidth_( Width_ ),
+    viewHeight_( Height_ ),
+    blockSize_( 8 ),
+    zBuffer_( Width_*Height_, FarDepth ),
+    blocksX_( 0 ),
+    blockDepth_(),
+    objectId_( 0u ),
+    TilesX_( ( Width_ + TileSize - 1 ) / TileSize ),
+    TilesY_( ( Height_ + TileSize - 1 ) / TileSize ),
+    touched_( TilesX_*TilesY_, 0 ),
+    restored_( TilesX_*TilesY_, 0 ),
+    clearAll_( true ),
+    presentAll_( true ),
+    Background_( SDL_MapRGB( surface->format, 0, 0, 0 ) ),
+    hasStatic_( false ),
+    staticColor_(),
+    staticDepth_(),
+    upscaleScratch_()
+    {
+        ASSERT( Width_ >= SmallSize, "Surface too narrow" );
+        setBlockSize( blockSize_ );
+    }
 
 Rasterizer::~Rasterizer() {}
 
+void Rasterizer::setBlockSize( int size ) {
+    ASSERT( size > 0, "Block size must be positive" );
+    blockSize_ = size;
+    
+    /*
+     * the block depths are only ever an upper bound, so starting over from the 
+     * far plane is always safe
+     * */
+    blocksX_ = ( Width_ + size - 1 ) / size;
+    blockDepth_.assign( blocksX_ * ( ( Height_ + size - 1 ) / size ), FarDepth );
+}
+
+void Rasterizer::setObjectId( uint32_t id ) {
+    objectId_ = id;
+}
+
 void Rasterizer::rasterize( const Vector4f& v0, const Vector4f& v1, const Vector4f& v2 ) {
     /*
      * Convert from normalized device coordinates to screen space coordinates
      * */
-    Vector3f p0( 0.5f*(v0.x + 1.0f)*Width_, -0.5f*(v0.y - 1.0f)*Height_, v0.z );
-    Vector3f p1( 0.5f*(v1.x + 1.0f)*Width_, -0.5f*(v0.y - 1.0f)*Height_, v1.z );
-    Vector3f p2( 0.5f*(v2.x + 1.0f)*Width_, -0.5f*(v2.y - 1.0f)*Height_, v2.z );
+    Vector3f p0( 0.5f*(v0.x + 1.0f)*viewWidth_, -0.5f*(v0.y - 1.0f)*viewHeight_, v0.z );
+    Vector3f p1( 0.5f*(v1.x + 1.0f)*viewWidth_, -0.5f*(v1.y - 1.0f)*viewHeight_, v1.z );
+    Vector3f p2( 0.5f*(v2.x + 1.0f)*viewWidth_, -0.5f*(v2.y - 1.0f)*viewHeight_, v2.z );
     
     /*
      * Calculate edge equations
@@ -105,36 +194,202 @@ void Rasterizer::rasterize( const Vector4f& v0, const Vector4f& v1, const Vector
         e2.flip();
     }
     
+    const float fMinX = std::min( p0.x, std::min( p1.x, p2.x ) );
+    const float fMaxX = std::max( p0.x, std::max( p1.x, p2.x ) );
+    const float fMinY = std::min( p0.y, std::min( p1.y, p2.y ) );
+    const float fMaxY = std::max( p0.y, std::max( p1.y, p2.y ) );
+    
     /*
-     * get the equations for interpolating a floating point value across 
-     * the triangle face
+     * triangles fitting in a single small block skip the rest of the setup
      * */
-    InterpolateVal depth( p0, v0.z, p1, v1.z, p2, v2.z );
+    if ( fMaxX - fMinX < SmallSize && fMaxY - fMinY < SmallSize && 
+         rasterizeSmall_( p0, p1, p2, e0, e1, e2, fMinX, fMaxX, fMinY, fMaxY ) ) {
+        return;
+    }
     
     /*
      * compute triangle bounding box
      * */
     int minX, maxX, minY, maxY;
-    minX = floor( std::min( p0.x, std::min( p1.x, p2.x ) ) );
-    maxX = ceil( std::max( p0.x, std::max( p1.x, p2.x ) ) );
-    minY = floor( std::min( p0.y, std::min( p1.y, p2.y ) ) );
-    maxY = ceil( std::max( p0.y, std::max( p1.y, p2.y ) ) );
+    minX = floor( fMinX );
+    maxX = ceil( fMaxX );
+    minY = floor( fMinY );
+    maxY = ceil( fMaxY );
     
     /*
-     * clip againts screen bounds
+     * clip againts the viewport
      * */
     minX = std::max( minX, 0 );
-    maxX = std::min( maxX, Width_ - 1 );
+    maxX = std::min( maxX, viewWidth_ - 1 );
     minY = std::max( minY, 0 );
-    maxY = std::min( maxY, Height_ - 1 );
+    maxY = std::min( maxY, viewHeight_ - 1 );
+    if ( minX > maxX || minY > maxY ) {
+        return;
+    }
+    markTiles_( minX, maxX, minY, maxY );
+    
+    /*
+     * get the equations for interpolating a floating point value across 
+     * the triangle face
+     * */
+    InterpolateVal depth( p0, v0.z, p1, v1.z, p2, v2.z );
+    
+    TriangleSetup t( e0, e1, e2, depth, depth.error( fMaxX - fMinX, fMaxY - fMinY ), minX, maxX, minY, maxY );
+    
+    /*
+     * choose the traversal from how much of the bounding box the triangle covers.
+     * 
+     * Thin slivers cover little of their bounding box, so the exact span of each row
+     * is computed from the edge equations instead of testing every pixel. Other 
+     * triangles spanning several blocks are traversed block by block, so that blocks
+     * away from the edges can be rejected or filled without edge tests.
+     * 
+     * The area computed from the edge equations is twice the triangle area.
+     * */
+    const int boxArea = ( maxX - minX + 1 )*( maxY - minY + 1 );
+    if ( SpanCoverage*std::abs( area ) < 2*boxArea ) {
+        scanSpans_( t );
+    } else if ( maxX - minX >= blockSize_ || maxY - minY >= blockSize_ ) {
+        scanBlocks_( t );
+    } else {
+        scanBox_( t, minX, maxX, minY, maxY );
+    }
+}
+
+bool Rasterizer::rasterizeSmall_( 
+    const Vector3f& p0, const Vector3f& p1, const Vector3f& p2, 
+    const EdgeEqn& e0, const EdgeEqn& e1, const EdgeEqn& e2, 
+    float minX, float maxX, float minY, float maxY 
+) {
+    if ( maxX < 0.0f || maxY < 0.0f ) {
+        return true;
+    }
+    
+    /*
+     * the same bounding box as for the larger triangles, clipped against the screen.
+     * Negative coordinates are clipped anyway, so truncation can stand in for floor.
+     * */
+    const int bbMinX = std::max( ( int ) minX, 0 );
+    const int bbMinY = std::max( ( int ) minY, 0 );
+    int bbMaxX = ( int ) maxX;
+    int bbMaxY = ( int ) maxY;
+    bbMaxX += bbMaxX < maxX ? 1 : 0;
+    bbMaxY += bbMaxY < maxY ? 1 : 0;
+    if ( bbMaxX - bbMinX >= SmallSize || bbMaxY - bbMinY >= SmallSize ) {
+        return false;
+    }
+    bbMaxX = std::min( bbMaxX, viewWidth_ - 1 );
+    bbMaxY = std::min( bbMaxY, viewHeight_ - 1 );
+    if ( bbMinX > bbMaxX || bbMinY > bbMaxY ) {
+        return true;
+    }
     
     /*
-     * scan the triangle within the bounding box
+     * the depth plane, z(x, y) = z + dzdx*x + dzdy*y, replaces the area-based
+     * interpolation used by the larger triangles
+     * */
+    const float dx1 = p1.x - p0.x, dy1 = p1.y - p0.y, dz1 = p1.z - p0.z;
+    const float dx2 = p2.x - p0.x, dy2 = p2.y - p0.y, dz2 = p2.z - p0.z;
+    const float det = dx1*dy2 - dx2*dy1;
+    if ( det == 0.0f ) {
+        return true;
+    }
+    const float inverseDet = 1.0f / det;
+    markTiles_( bbMinX, bbMaxX, bbMinY, bbMaxY );
+    
+    /*
+     * the block is kept on the screen, so that whole block rows can be loaded at
+     * once. Columns outside the bounding box are masked out.
+     * */
+    SmallTriangle t;
+    t.x = std::min( bbMinX, Width_ - SmallSize );
+    t.y = bbMinY;
+    t.firstCol = bbMinX - t.x;
+    t.lastCol = bbMaxX - t.x;
+    t.rows = bbMaxY - bbMinY + 1;
+    t.e[0] = e0.eval( t.x, t.y );
+    t.e[1] = e1.eval( t.x, t.y );
+    t.e[2] = e2.eval( t.x, t.y );
+    t.A[0] = e0.A; t.A[1] = e1.A; t.A[2] = e2.A;
+    t.B[0] = e0.B; t.B[1] = e1.B; t.B[2] = e2.B;
+    t.dzdx = ( dz1*dy2 - dz2*dy1 )*inverseDet;
+    t.dzdy = ( dx1*dz2 - dx2*dz1 )*inverseDet;
+    t.z = p0.z + t.dzdx*( t.x - p0.x ) + t.dzdy*( t.y - p0.y );
+    
+    scanSmall_( t );
+    return true;
+}
+
+void Rasterizer::scanSmall_( const SmallTriangle& t ) {
+#ifdef USE_SSE2
+    /*
+     * the block is processed in columns of four pixels. Each iteration evaluates 
+     * the edge equations and the depth test for four pixels of a row at once.
      * */
-    const unsigned int bytesPerPixel = surface_->pitch / surface_->w;
-    unsigned char* pixels = ( unsigned char* ) surface_->pixels;
-    pixels += minY  * surface_->pitch;
+    const __m128i minusOne = _mm_set1_epi32( -1 );
+    const __m128i B0 = _mm_set1_epi32( t.B[0] );
+    const __m128i B1 = _mm_set1_epi32( t.B[1] );
+    const __m128i B2 = _mm_set1_epi32( t.B[2] );
+    const __m128 dzdy = _mm_set1_ps( t.dzdy );
     
+    for ( int c = t.firstCol & ~3; c <= t.lastCol; c += 4 ) {
+        const __m128i col = _mm_setr_epi32( c, c + 1, c + 2, c + 3 );
+        const __m128i inBox = _mm_and_si128( 
+            _mm_cmpgt_epi32( col, _mm_set1_epi32( t.firstCol - 1 ) ),
+            _mm_cmpgt_epi32( _mm_set1_epi32( t.lastCol + 1 ), col )
+        );
+        const int s0 = t.e[0] + c*t.A[0];
+        const int s1 = t.e[1] + c*t.A[1];
+        const int s2 = t.e[2] + c*t.A[2];
+        __m128i se0 = _mm_setr_epi32( s0, s0 + t.A[0], s0 + 2*t.A[0], s0 + 3*t.A[0] );
+        __m128i se1 = _mm_setr_epi32( s1, s1 + t.A[1], s1 + 2*t.A[1], s1 + 3*t.A[1] );
+        __m128i se2 = _mm_setr_epi32( s2, s2 + t.A[2], s2 + 2*t.A[2], s2 + 3*t.A[2] );
+        const float z0 = t.z + c*t.dzdx;
+        __m128 z = _mm_setr_ps( z0, z0 + t.dzdx, z0 + 2.0f*t.dzdx, z0 + 3.0f*t.dzdx );
+        
+        for ( int i = 0; i < t.rows; i++ ) {
+            const __m128i inside = _mm_and_si128( inBox,
+                _mm_cmpgt_epi32( _mm_or_si128( se0, _mm_or_si128( se1, se2 ) ), minusOne )
+            );
+            if ( _mm_movemask_epi8( inside ) ) {
+                float* depth = &zBuffer_[index_( t.y + i, t.x + c )];
+                const __m128 oldZ = _mm_loadu_ps( depth );
+                const __m128 mask = _mm_and_ps( _mm_castsi128_ps( inside ), _mm_cmplt_ps( z, oldZ ) );
+                const int bits = _mm_movemask_ps( mask );
+                if ( bits ) {
+                    _mm_storeu_ps( depth, _mm_or_ps( _mm_and_ps( mask, z ), _mm_andnot_ps( mask, oldZ ) ) );
+                    float zs[4];
+                    _mm_storeu_ps( zs, z );
+                    uint32_t* p = row_( t.y + i ) + t.x + c;
+                    for ( int j = 0; j < 4; j++ ) {
+                        if ( bits & ( 1 << j ) ) {
+                            p[j] = color_( zs[j] );
+                        }
+                    }
+                }
+            }
+            se0 = _mm_add_epi32( se0, B0 );
+            se1 = _mm_add_epi32( se1, B1 );
+            se2 = _mm_add_epi32( se2, B2 );
+            z = _mm_add_ps( z, dzdy );
+        }
+    }
+#else
+    for ( int i = 0; i < t.rows; i++ ) {
+        uint32_t* p = row_( t.y + i ) + t.x;
+        for ( int j = t.firstCol; j <= t.lastCol; j++ ) {
+            const int se0 = t.e[0] + t.A[0]*j + t.B[0]*i;
+            const int se1 = t.e[1] + t.A[1]*j + t.B[1]*i;
+            const int se2 = t.e[2] + t.A[2]*j + t.B[2]*i;
+            if ( ( se0 | se1 | se2 ) >= 0 ) {
+                shade_( p + j, t.y + i, t.x + j, t.z + t.dzdx*j + t.dzdy*i );
+            }
+        }
+    }
+#endif
+}
+
+void Rasterizer::scanBox_( const TriangleSetup& t, int minX, int maxX, int minY, int maxY ) {
     /*
      * pre-calculate the sign of the edge equations
      * 
@@ -146,44 +401,337 @@ void Rasterizer::rasterize( const Vector4f& v0, const Vector4f& v1, const Vector
      * 
      * to save time in the loop.
      * */
-     int se0 = e0.eval( minX, minY );
-     int se1 = e1.eval( minX, minY );
-     int se2 = e2.eval( minX, minY );
+    int se0 = t.e0.eval( minX, minY );
+    int se1 = t.e1.eval( minX, minY );
+    int se2 = t.e2.eval( minX, minY );
     
     for ( int i = minY; i <= maxY; i++ ) {
-        pixels += minX * bytesPerPixel;
-        uint32_t* p = ( uint32_t* ) pixels;
+        uint32_t* p = row_( i ) + minX;
         int rowSe0 = se0;
         int rowSe1 = se1;
         int rowSe2 = se2;
         
         for ( int j = minX; j <= maxX; j++ ) {
+            if ( ( rowSe0 | rowSe1 | rowSe2 ) >= 0 ) {
+                shade_( p, i, j, t.depth.eval( (float)j, (float)i ) );
+            }
             
-            const float z = depth.eval( (float)j, (float)i );
+            p++;
+            rowSe0 += t.e0.A;
+            rowSe1 += t.e1.A;
+            rowSe2 += t.e2.A;
+        }
+        se0 += t.e0.B;
+        se1 += t.e1.B;
+        se2 += t.e2.B;
+    }
+}
+
+void Rasterizer::fillBox_( const TriangleSetup& t, int minX, int maxX, int minY, int maxY ) {
+    for ( int i = minY; i <= maxY; i++ ) {
+        uint32_t* p = row_( i ) + minX;
+        for ( int j = minX; j <= maxX; j++ ) {
+            shade_( p++, i, j, t.depth.eval( (float)j, (float)i ) );
+        }
+    }
+}
+
+namespace {
+
+enum Coverage {
+    Outside,
+    Partial,
+    Inside
+};
+
+/*
+ * Classify the pixels of a w x h block against a single edge. The edge equation is 
+ * linear, so its extremes over the block are found at the corner pixels.
+ * */
+inline Coverage classify( const EdgeEqn& e, int x, int y, int w, int h ) {
+    const int c00 = e.eval( x, y );
+    const int c10 = c00 + e.A*( w - 1 );
+    const int c01 = c00 + e.B*( h - 1 );
+    const int c11 = c10 + e.B*( h - 1 );
+    if ( ( c00 & c10 & c01 & c11 ) < 0 ) {
+        return Outside;
+    }
+    if ( ( c00 | c10 | c01 | c11 ) >= 0 ) {
+        return Inside;
+    }
+    return Partial;
+}
+
+}
+
+namespace {
+
+/*
+ * Narrow the span [first, last] of row offsets d for which s + A*d >= 0. 
+ * Returns false if the span becomes empty.
+ * */
+inline bool narrow( int s, int A, int& first, int& last ) {
+    if ( A > 0 ) {
+        if ( s < 0 ) {
+            first = std::max( first, ( -s + A - 1 ) / A );
+        }
+    } else if ( s < 0 ) {
+        return false;
+    } else if ( A < 0 ) {
+        last = std::min( last, s / -A );
+    }
+    return first <= last;
+}
+
+}
+
+void Rasterizer::scanSpans_( const TriangleSetup& t ) {
+    int se0 = t.e0.eval( t.minX, t.minY );
+    int se1 = t.e1.eval( t.minX, t.minY );
+    int se2 = t.e2.eval( t.minX, t.minY );
+    
+    for ( int i = t.minY; i <= t.maxY; i++ ) {
+        int first = 0;
+        int last = t.maxX - t.minX;
+        if ( narrow( se0, t.e0.A, first, last ) && 
+             narrow( se1, t.e1.A, first, last ) && 
+             narrow( se2, t.e2.A, first, last ) ) {
+            fillBox_( t, t.minX + first, t.minX + last, i, i );
+        }
+        se0 += t.e0.B;
+        se1 += t.e1.B;
+        se2 += t.e2.B;
+    }
+}
+
+void Rasterizer::scanBlocks_( const TriangleSetup& t ) {
+    /*
+     * blocks are aligned to a screen-space grid of blockSize_ pixels, 
+     * and clipped against the bounding box
+     * */
+    const int startX = t.minX - t.minX % blockSize_;
+    const int startY = t.minY - t.minY % blockSize_;
+    
+    for ( int by = startY; by <= t.maxY; by += blockSize_ ) {
+        const int y0 = std::max( by, t.minY );
+        const int y1 = std::min( by + blockSize_ - 1, t.maxY );
+        
+        for ( int bx = startX; bx <= t.maxX; bx += blockSize_ ) {
+            const int x0 = std::max( bx, t.minX );
+            const int x1 = std::min( bx + blockSize_ - 1, t.maxX );
+            const int w = x1 - x0 + 1;
+            const int h = y1 - y0 + 1;
             
-            if ( zBuffer_[index_(i, j)] > z && ( rowSe0 | rowSe1 | rowSe2 ) >= 0 ) {
-                zBuffer_[index_(i, j)] = z;
-                unsigned char c = 255.0f - 255.0f*(0.5f*(z + 1.0f));
-                *p = SDL_MapRGB( surface_->format, c, c, c );
+            const Coverage c0 = classify( t.e0, x0, y0, w, h );
+            if ( c0 == Outside ) {
+                continue;
+            }
+            const Coverage c1 = classify( t.e1, x0, y0, w, h );
+            if ( c1 == Outside ) {
+                continue;
+            }
+            const Coverage c2 = classify( t.e2, x0, y0, w, h );
+            if ( c2 == Outside ) {
+                continue;
             }
             
-            p++;
-            rowSe0 += e0.A;
-            rowSe1 += e1.A;
-            rowSe2 += e2.A;
+            if ( c0 == Inside && c1 == Inside && c2 == Inside ) {
+                /*
+                 * the depth is linear, so its extremes over the block are at the corners,
+                 * give or take rounding. If the nearest is behind everything in the block,
+                 * no pixel can pass the depth test.
+                 * */
+                float& blockDepth = blockDepth_[( by / blockSize_ )*blocksX_ + bx / blockSize_];
+                const float z00 = t.depth.eval( x0, y0 ), z10 = t.depth.eval( x1, y0 );
+                const float z01 = t.depth.eval( x0, y1 ), z11 = t.depth.eval( x1, y1 );
+                if ( std::min( std::min( z00, z10 ), std::min( z01, z11 ) ) - t.depthError >= blockDepth ) {
+                    continue;
+                }
+                fillBox_( t, x0, x1, y0, y1 );
+                
+                /*
+                 * no pixel of a fully covered block is now farther than the farthest corner
+                 * */
+                if ( x0 == bx && y0 == by && 
+                     x1 == std::min( bx + blockSize_, Width_ ) - 1 && 
+                     y1 == std::min( by + blockSize_, Height_ ) - 1 ) {
+                    blockDepth = std::min( blockDepth, std::max( std::max( z00, z10 ), std::max( z01, z11 ) ) + t.depthError );
+                }
+            } else {
+                scanBox_( t, x0, x1, y0, y1 );
+            }
         }
-        se0 += e0.B;
-        se1 += e1.B;
-        se2 += e2.B;
-        pixels += bytesPerPixel * ( Width_ - minX );
     }
 }
 
 void Rasterizer::clear() {
+    TRACE_SCOPE( "clear" );
     for ( std::size_t i = 0u; i < zBuffer_.size(); i += 4 ) {
-        zBuffer_[i] = 100000.0f;
-        zBuffer_[i+1] = 100000.0f;
-        zBuffer_[i+2] = 100000.0f;
-        zBuffer_[i+3] = 100000.0f;
+        zBuffer_[i] = FarDepth;
+        zBuffer_[i+1] = FarDepth;
+        zBuffer_[i+2] = FarDepth;
+        zBuffer_[i+3] = FarDepth;
+    }
+    std::fill( blockDepth_.begin(), blockDepth_.end(), FarDepth );
+    hasStatic_ = false;
+    clearAll_ = true;
+}
+
+void Rasterizer::beginFrame() {
+    TRACE_SCOPE( "beginFrame" );
+    
+    /*
+     * nothing outside the viewport is drawn to, so clearing everything only 
+     * needs to cover the tiles of the viewport
+     * */
+    const int viewTilesX = ( viewWidth_ + TileSize - 1 ) / TileSize;
+    const int viewTilesY = ( viewHeight_ + TileSize - 1 ) / TileSize;
+    for ( int k = 0; k < TilesX_*TilesY_; k++ ) {
+        const bool inView = k % TilesX_ < viewTilesX && k / TilesX_ < viewTilesY;
+        if ( ( clearAll_ && inView ) || touched_[k] ) {
+            restoreTile_( k );
+            restored_[k] = 1;
+            touched_[k] = 0;
+        }
+    }
+    presentAll_ = presentAll_ || clearAll_;
+    clearAll_ = false;
+}
+
+void Rasterizer::setViewport( int width, int height ) {
+    ASSERT( width >= SmallSize && width <= Width_ && height > 0 && height <= Height_, "Viewport does not fit the surface" );
+    viewWidth_ = width;
+    viewHeight_ = height;
+    hasStatic_ = false;
+    clearAll_ = true;
+}
+
+void Rasterizer::upscale() {
+    TRACE_SCOPE( "upscale" );
+    if ( viewWidth_ == Width_ && viewHeight_ == Height_ ) {
+        return;
+    }
+    Upscale( surface_, viewWidth_, viewHeight_, upscaleScratch_ );
+    
+    /*
+     * the whole surface changed, and the viewport no longer holds the frame
+     * */
+    clearAll_ = true;
+    presentAll_ = true;
+}
+
+void Rasterizer::beginStatic() {
+    hasStatic_ = false;
+    clearAll_ = true;
+    beginFrame();
+}
+
+void Rasterizer::endStatic() {
+    staticColor_.resize( Width_*Height_ );
+    for ( int i = 0; i < Height_; i++ ) {
+        std::copy( row_( i ), row_( i ) + Width_, &staticColor_[i*Width_] );
+    }
+    staticDepth_ = zBuffer_;
+    hasStatic_ = true;
+    
+    /*
+     * the static layer is what the tiles are restored to, so it leaves nothing to clear
+     * */
+    std::fill( touched_.begin(), touched_.end(), 0 );
+    presentAll_ = true;
+}
+
+void Rasterizer::dirtyRects( std::vector<SDL_Rect>& rects ) {
+    rects.clear();
+    if ( presentAll_ ) {
+        SDL_Rect all = { 0, 0, Width_, Height_ };
+        rects.push_back( all );
+    } else {
+        /*
+         * rects from firstOpen on reach down to the current row, and can be extended
+         * */
+        std::size_t firstOpen = 0u;
+        for ( int ty = 0; ty < TilesY_; ty++ ) {
+            const std::size_t row = rects.size();
+            for ( int tx = 0; tx < TilesX_; ) {
+                const int k = ty*TilesX_ + tx;
+                if ( !touched_[k] && !restored_[k] ) {
+                    tx++;
+                    continue;
+                }
+                int end = tx + 1;
+                while ( end < TilesX_ && ( touched_[k + end - tx] || restored_[k + end - tx] ) ) {
+                    end++;
+                }
+                SDL_Rect r;
+                r.x = tx*TileSize;
+                r.y = ty*TileSize;
+                r.w = std::min( end*TileSize, Width_ ) - r.x;
+                r.h = std::min( ( ty + 1 )*TileSize, Height_ ) - r.y;
+                tx = end;
+                
+                /*
+                 * extend a rect reaching down to this row with the same extent
+                 * */
+                bool merged = false;
+                for ( std::size_t i = firstOpen; i < row && !merged; i++ ) {
+                    if ( rects[i].x == r.x && rects[i].w == r.w && rects[i].y + rects[i].h == r.y ) {
+                        rects[i].h += r.h;
+                        merged = true;
+                    }
+                }
+                if ( !merged ) {
+                    rects.push_back( r );
+                }
+            }
+            
+            /*
+             * move the rects which end above the next row out of the open range
+             * */
+            const int bottom = std::min( ( ty + 1 )*TileSize, Height_ );
+            for ( std::size_t i = firstOpen; i < rects.size(); i++ ) {
+                if ( rects[i].y + rects[i].h < bottom ) {
+                    std::swap( rects[i], rects[firstOpen] );
+                    firstOpen++;
+                }
+            }
+        }
+    }
+    std::fill( restored_.begin(), restored_.end(), 0 );
+    presentAll_ = false;
+}
+
+void Rasterizer::markTiles_( int minX, int maxX, int minY, int maxY ) {
+    for ( int ty = minY / TileSize; ty <= maxY / TileSize; ty++ ) {
+        unsigned char* t = &touched_[ty*TilesX_];
+        for ( int tx = minX / TileSize; tx <= maxX / TileSize; tx++ ) {
+            t[tx] = 1;
+        }
+    }
+}
+
+void Rasterizer::restoreTile_( int tile ) {
+    const int x0 = ( tile % TilesX_ )*TileSize;
+    const int y0 = ( tile / TilesX_ )*TileSize;
+    const int x1 = std::min( x0 + TileSize, Width_ );
+    const int y1 = std::min( y0 + TileSize, Height_ );
+    for ( int i = y0; i < y1; i++ ) {
+        float* depth = &zBuffer_[index_( i, x0 )];
+        if ( hasStatic_ ) {
+            std::copy( &staticColor_[i*Width_ + x0], &staticColor_[i*Width_ + x1], row_( i ) + x0 );
+            std::copy( &staticDepth_[i*Width_ + x0], &staticDepth_[i*Width_ + x1], depth );
+        } else {
+            std::fill( row_( i ) + x0, row_( i ) + x1, Background_ );
+            std::fill( depth, depth + ( x1 - x0 ), FarDepth );
+        }
+    }
+    
+    /*
+     * the depths went back up, so the bounds of the blocks overlapping the tile no longer hold
+     * */
+    for ( int by = y0 / blockSize_; by <= ( y1 - 1 ) / blockSize_; by++ ) {
+        for ( int bx = x0 / blockSize_; bx <= ( x1 - 1 ) / blockSize_; bx++ ) {
+            blockDepth_[by*blocksX_ + bx] = FarDepth;
+        }
     }
 }
@@ -4,8 +4,12 @@
 #include <SDL2/SDL_surface.h>
 #include "vector.h"
 #include "assert.h"
+#include "int.h"
 #include <vector>
 
+struct EdgeEqn;
+struct TriangleSetup;
+
 /**
  * @class Rasterizer
  * @date 09/09/15
@@ -27,12 +31,141 @@ class Rasterizer {
         
         /**
          * @brief Clear the depth buffer.
+         * 
+         * The static layer is discarded, and the next beginFrame() clears the whole surface.
          */
         void clear();
         
+        /**
+         * @brief Start a new frame.
+         * 
+         * Only the tiles drawn to since the previous frame started are cleared, back to
+         * the static layer where there is one, and to black elsewhere. The first frame 
+         * clears the whole surface.
+         */
+        void beginFrame();
+        
+        /**
+         * @brief Clear the whole surface, and start drawing the static layer.
+         */
+        void beginStatic();
+        
+        /**
+         * @brief Keep everything drawn since beginStatic() as the static layer, which 
+         * beginFrame() restores tiles to.
+         */
+        void endStatic();
+        
+        /**
+         * @brief Get the rectangles of the surface which changed since the previous call. 
+         * 
+         * Tiles drawn to, or cleared by beginFrame(), are merged into runs along each row 
+         * of tiles, and runs of the same width in consecutive rows are merged further.
+         * @param rects replaced with the changed rectangles
+         */
+        void dirtyRects( std::vector<SDL_Rect>& rects );
+        
+        /**
+         * @brief The width of the viewport, which triangles are rendered into.
+         */
+        inline int width() const {
+            return viewWidth_;
+        }
+        
+        inline int height() const {
+            return viewHeight_;
+        }
+        
+        /**
+         * @brief Render into the top left width x height pixels of the surface only.
+         * 
+         * The next beginFrame() clears the whole viewport, and the static layer is discarded.
+         */
+        void setViewport( int width, int height );
+        
+        /**
+         * @brief Scale the viewport up to fill the whole surface, with bilinear filtering.
+         * 
+         * Does nothing when the viewport is the whole surface. Otherwise, the next 
+         * beginFrame() clears the whole viewport, and the whole surface is presented.
+         */
+        void upscale();
+        
+        /**
+         * @brief Set the size of the square pixel blocks used when traversing large triangles.
+         * 
+         * Blocks entirely outside a triangle are skipped, and blocks entirely inside
+         * are filled without edge tests.
+         * @param size the block edge length in pixels
+         */
+        void setBlockSize( int size );
+        
+        /**
+         * @brief Write an object id to the covered pixels, instead of a shade of the depth.
+         * @param id the value written to the pixels, or zero to shade by depth again
+         */
+        void setObjectId( uint32_t id );
+        
     private:
         Rasterizer();
         
+        struct SmallTriangle;
+        
+        void scanBlocks_( const TriangleSetup& );
+        void scanSmall_( const SmallTriangle& );
+        void scanSpans_( const TriangleSetup& );
+        void scanBox_( const TriangleSetup&, int minX, int maxX, int minY, int maxY );
+        void fillBox_( const TriangleSetup&, int minX, int maxX, int minY, int maxY );
+        void markTiles_( int minX, int maxX, int minY, int maxY );
+        void restoreTile_( int tile );
+        bool rasterizeSmall_( 
+            const Vector3f&, const Vector3f&, const Vector3f&, 
+            const EdgeEqn&, const EdgeEqn&, const EdgeEqn&, 
+            float minX, float maxX, float minY, float maxY 
+        );
+        
+        inline uint32_t* row_( int i ) const {
+            return ( uint32_t* )( ( unsigned char* ) surface_->pixels + i*surface_->pitch );
+        }
+        
+        inline uint32_t color_( float z ) const {
+            if ( objectId_ ) {
+                return objectId_;
+            }
+            unsigned char c = 255.0f - 255.0f*(0.5f*(z + 1.0f));
+            return SDL_MapRGB( surface_->format, c, c, c );
+        }
+        
+        /*
+         * depth test and write the pixel at row i, column j
+         * */
+        inline void shade_( uint32_t* p, int i, int j, float z ) {
+            float& depth = zBuffer_[index_(i, j)];
+            if ( depth > z ) {
+                depth = z;
+                *p = color_( z );
+            }
+        }
+        
+        /*
+         * A triangle which fits in a SmallSize x SmallSize pixel block, set up 
+         * so that all pixels of the block can be evaluated at once.
+         * */
+        struct SmallTriangle {
+            int x, y;               // the block origin
+            int firstCol, lastCol;  // the bounding box, relative to the block origin
+            int rows;
+            int e[3];               // the edge equations at the block origin
+            int A[3], B[3];
+            float z, dzdx, dzdy;    // the depth plane at the block origin
+        };
+        
+        enum { 
+            SmallSize = 8,
+            SpanCoverage = 4,   // triangles covering less than 1/SpanCoverage of their bounding box are traversed in spans
+            TileSize = 32       // the granularity of clearing and presenting
+        };
+        
         inline int index_( int i, int j ) const {
             int r = i*surface_->w + j;
             ASSERT( r < surface_->w*surface_->h, "Index out of bounds" );
@@ -42,7 +175,30 @@ class Rasterizer {
         SDL_Surface* surface_;
         const int Width_;
         const int Height_;
+        int viewWidth_;
+        int viewHeight_;
+        int blockSize_;
         std::vector<float> zBuffer_;
+        int blocksX_;
+        std::vector<float> blockDepth_;     // an upper bound of the depths in each block
+        uint32_t objectId_;
+        
+        /*
+         * tiles drawn to since the frame started, and tiles cleared by beginFrame()
+         * since the changed rectangles were last asked for
+         * */
+        const int TilesX_;
+        const int TilesY_;
+        std::vector<unsigned char> touched_;
+        std::vector<unsigned char> restored_;
+        bool clearAll_;
+        bool presentAll_;
+        
+        const uint32_t Background_;
+        bool hasStatic_;
+        std::vector<uint32_t> staticColor_;
+        std::vector<float> staticDepth_;
+        std::vector<uint32_t> upscaleScratch_;
 };
 
 #endif
\ No newline at end of file
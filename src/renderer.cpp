@@ -1,4 +1,9 @@
 #include "renderer.h"
+#include "capture.h"
+#include "quantized.h"
+#include "transform.h"
+#include "trace.h"
+#include "assert.h"
 #include <cstdlib>
 
 Matrix4f OrthoProjection( const OrthoCamera& c ) {
@@ -10,11 +15,135 @@ Matrix4f OrthoProjection( const OrthoCamera& c ) {
     );
 }
 
+namespace {
+
+CaptureWriter* ActiveCapture = NULL;
+
+/*
+ * Transformed vertices and composed instance matrices, reused between draw calls so 
+ * that a draw does not allocate once they have grown. Draws are only submitted from
+ * one thread.
+ * */
+std::vector< Vector4f > TransformedScratch;
+std::vector< Matrix4f > TransformScratch;
+
+void RasterizeBuffer( Rasterizer& r, const std::vector< Vector4f >& buffer ) {
+    for ( std::size_t i = 0u; i + 2 < buffer.size(); i += 3 ) {
+        r.rasterize( buffer[i], buffer[i+1], buffer[i+2] );
+    }
+}
+
+void RenderQuantized( 
+    Rasterizer& r, 
+    const QuantizedMesh& mesh, 
+    const Matrix4f* models, 
+    std::size_t count, 
+    const OrthoCamera& c 
+) {
+    TRACE_SCOPE( "RenderInstanced quantized" );
+    if ( mesh.positions.empty() ) {
+        return;
+    }
+    if ( ActiveCapture ) {
+        ActiveCapture->draw( mesh, models, count, c );
+    }
+    
+    /*
+     * the dequantization is the rightmost factor of each instance transform
+     * */
+    std::vector< Matrix4f >& transforms = TransformScratch;
+    transforms.resize( count );
+    ComposeMatrices( OrthoProjection( c ), models, &transforms[0], count );
+    const Matrix4f dequantization = mesh.dequantization();
+    
+    std::vector< Vector4f >& transformed = TransformedScratch;
+    transformed.resize( mesh.vertexCount() );
+    for ( std::size_t i = 0u; i < count; i++ ) {
+        TransformQuantized( transforms[i] * dequantization, &mesh.positions[0], &transformed[0], transformed.size() );
+        RasterizeBuffer( r, transformed );
+    }
+}
+
+}
+
+void SetCapture( CaptureWriter* writer ) {
+    ActiveCapture = writer;
+}
+
 void Render( Rasterizer& r, const std::vector< Vector4f >& buffer, const Matrix4f& model, const OrthoCamera& c ) {
-    for ( std::size_t i = 0u; i < buffer.size(); i += 3 ) {
-        Vector4f v1 = OrthoProjection( c ) * model * buffer[i];
-        Vector4f v2 = OrthoProjection( c ) * model * buffer[i+1];
-        Vector4f v3 = OrthoProjection( c ) * model * buffer[i+2];
-        r.rasterize( v1, v2, v3 );
+    TRACE_SCOPE( "Render" );
+    if ( buffer.empty() ) {
+        return;
+    }
+    if ( ActiveCapture ) {
+        ActiveCapture->draw( buffer, &model, 1u, c );
+    }
+    std::vector< Vector4f >& transformed = TransformedScratch;
+    transformed.resize( buffer.size() );
+    TransformVertices( OrthoProjection( c ) * model, &buffer[0], &transformed[0], buffer.size() );
+    RasterizeBuffer( r, transformed );
+}
+
+void RenderInstanced( 
+    Rasterizer& r, 
+    const std::vector< Vector4f >& buffer, 
+    const std::vector< Matrix4f >& models, 
+    const OrthoCamera& c 
+) {
+    TRACE_SCOPE( "RenderInstanced" );
+    if ( buffer.empty() || models.empty() ) {
+        return;
+    }
+    if ( ActiveCapture ) {
+        ActiveCapture->draw( buffer, &models[0], models.size(), c );
+    }
+    /*
+     * compose every instance matrix with the projection up front, so that the
+     * per-instance work is just the vertex transform and rasterization
+     * */
+    std::vector< Matrix4f >& transforms = TransformScratch;
+    transforms.resize( models.size() );
+    ComposeMatrices( OrthoProjection( c ), &models[0], &transforms[0], models.size() );
+    
+    std::vector< Vector4f >& transformed = TransformedScratch;
+    transformed.resize( buffer.size() );
+    for ( std::size_t i = 0u; i < transforms.size(); i++ ) {
+        TransformVertices( transforms[i], &buffer[0], &transformed[0], buffer.size() );
+        RasterizeBuffer( r, transformed );
+    }
+}
+
+void RenderInstanced( 
+    Rasterizer& r, 
+    const std::vector< Vector4f >& buffer, 
+    const std::vector< Quatf >& orientations, 
+    const std::vector< Vector3f >& translations, 
+    const OrthoCamera& c 
+) {
+    ASSERT( orientations.size() == translations.size(), "Instance array lengths differ" );
+    std::vector< Matrix4f > models;
+    models.reserve( orientations.size() );
+    for ( std::size_t i = 0u; i < orientations.size(); i++ ) {
+        Matrix4f m = orientations[i].asMatrix();
+        m.data[3] = translations[i].x;
+        m.data[7] = translations[i].y;
+        m.data[11] = translations[i].z;
+        models.push_back( m );
+    }
+    RenderInstanced( r, buffer, models, c );
+}
+
+void Render( Rasterizer& r, const QuantizedMesh& mesh, const Matrix4f& model, const OrthoCamera& c ) {
+    RenderQuantized( r, mesh, &model, 1u, c );
+}
+
+void RenderInstanced( 
+    Rasterizer& r, 
+    const QuantizedMesh& mesh, 
+    const std::vector< Matrix4f >& models, 
+    const OrthoCamera& c 
+) {
+    if ( !models.empty() ) {
+        RenderQuantized( r, mesh, &models[0], models.size(), c );
     }
 }
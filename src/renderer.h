@@ -4,14 +4,55 @@
 #include "rasterizer.h"
 #include "vector.h"
 #include "matrix.h"
+#include "quaternion.h"
 #include "int.h"
 #include <vector>
 
+class CaptureWriter;
+struct QuantizedMesh;
+
 struct OrthoCamera {
     float near, far, width, height;
 };
 
+Matrix4f OrthoProjection( const OrthoCamera& );
+
+/**
+ * @brief Record every subsequent draw call with the writer. Pass NULL to stop recording.
+ */
+void SetCapture( CaptureWriter* );
+
 void Render( Rasterizer&, const std::vector< Vector4f >&, const Matrix4f&, const OrthoCamera& );
 
+/**
+ * @brief Render one mesh once for each model matrix in the instance array.
+ * 
+ * The projection is built once per call, and all instance matrices are composed
+ * with it in a single pass before any vertices are transformed.
+ */
+void RenderInstanced( Rasterizer&, const std::vector< Vector4f >&, const std::vector< Matrix4f >&, const OrthoCamera& );
+
+/**
+ * @brief Render one mesh once for each orientation and translation pair.
+ * 
+ * The orientation and translation arrays must be of the same length.
+ */
+void RenderInstanced( 
+    Rasterizer&, 
+    const std::vector< Vector4f >&, 
+    const std::vector< Quatf >&, 
+    const std::vector< Vector3f >&, 
+    const OrthoCamera& 
+);
+
+/**
+ * @brief Render a quantized mesh. Dequantization is folded into the vertex transform.
+ */
+void Render( Rasterizer&, const QuantizedMesh&, const Matrix4f&, const OrthoCamera& );
+
+/**
+ * @brief Render a quantized mesh once for each model matrix in the instance array.
+ */
+void RenderInstanced( Rasterizer&, const QuantizedMesh&, const std::vector< Matrix4f >&, const OrthoCamera& );
 
-#endif
\ No newline at end of file
+#endif
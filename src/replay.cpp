@@ -0,0 +1,162 @@
+#ifdef _MSC_VER
+#   include <SDL.h>
+#else
+#   include <SDL2/SDL.h>
+#endif
+#include "capture.h"
+#include "rasterizer.h"
+#include "renderer.h"
+#include "int.h"
+#include <stdio.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+/*
+ * Replays a capture file headless, as fast as possible, and reports the time and 
+ * an image checksum for each frame.
+ * 
+ * usage: umbra_replay <capture file> [repeat count] [--block-size n] [--check]
+ * 
+ * With a repeat count, the capture is replayed several times and the fastest
+ * time of each frame is reported.
+ * 
+ * --block-size sets the size of the pixel blocks which large triangles are traversed in.
+ * With --check, each frame is also rendered with every triangle traversed pixel by
+ * pixel, and the program fails if any frame differs from the block traversal, which
+ * skips and fills whole blocks.
+ * */
+
+namespace {
+
+/*
+ * FNV-1a over the visible pixels of the surface
+ * */
+uint32_t Checksum( const SDL_Surface* surface ) {
+    uint32_t h = 2166136261u;
+    const unsigned char* pixels = ( const unsigned char* ) surface->pixels;
+    for ( int i = 0; i < surface->h; i++ ) {
+        for ( int j = 0; j < surface->w * 4; j++ ) {
+            h = ( h ^ pixels[j] ) * 16777619u;
+        }
+        pixels += surface->pitch;
+    }
+    return h;
+}
+
+/*
+ * render a frame onto a cleared surface, scaled up to the whole surface as it was shown
+ * */
+void RenderFrame( Rasterizer& r, SDL_Surface* surface, const Capture& capture, const CapturedFrame& frame ) {
+    unsigned char* pixels = ( unsigned char* ) surface->pixels;
+    for ( int row = 0; row < surface->h; row++ ) {
+        memset( pixels, 0, surface->w * 4 );
+        pixels += surface->pitch;
+    }
+    Render( r, capture, frame );
+    r.upscale();
+    r.clear();
+}
+
+/*
+ * Render every frame with the block traversal, and with blocks larger than the
+ * surface, so that no triangle is traversed by blocks. Returns the number of frames
+ * which differ.
+ * */
+int CheckTraversal( const Capture& capture, SDL_Surface* surface, int blockSize ) {
+    SDL_Surface* reference = SDL_CreateRGBSurface( 
+        0, surface->w, surface->h, 32, 
+        0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000 
+    );
+    if ( !reference ) {
+        return int( capture.frames.size() );
+    }
+    Rasterizer blocks( surface );
+    Rasterizer pixels( reference );
+    blocks.setBlockSize( blockSize );
+    pixels.setBlockSize( std::max( surface->w, surface->h ) + 1 );
+    
+    int failed = 0;
+    for ( std::size_t i = 0u; i < capture.frames.size(); i++ ) {
+        RenderFrame( blocks, surface, capture, capture.frames[i] );
+        RenderFrame( pixels, reference, capture, capture.frames[i] );
+        if ( Checksum( surface ) != Checksum( reference ) ) {
+            printf("frame %4u: block traversal differs from pixel traversal\n", unsigned( i ));
+            failed++;
+        }
+    }
+    SDL_FreeSurface( reference );
+    return failed;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    if ( argc < 2 ) {
+        printf("usage: %s <capture file> [repeat count] [--block-size n] [--check]\n", argv[0]);
+        return 1;
+    }
+    int repeat = 1;
+    int blockSize = 8;
+    bool check = false;
+    for ( int i = 2; i < argc; i++ ) {
+        if ( strcmp( argv[i], "--check" ) == 0 ) {
+            check = true;
+        } else if ( strcmp( argv[i], "--block-size" ) == 0 && i + 1 < argc ) {
+            blockSize = std::max( atoi( argv[++i] ), 1 );
+        } else {
+            repeat = std::max( atoi( argv[i] ), 1 );
+        }
+    }
+    
+    Capture capture;
+    if ( !capture.load( argv[1] ) ) {
+        printf("Could not read capture file %s.\n", argv[1]);
+        return 2;
+    }
+    
+    SDL_Surface* surface = SDL_CreateRGBSurface( 
+        0, capture.width, capture.height, 32, 
+        0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000 
+    );
+    if ( !surface ) {
+        printf("Could not create surface: %s\n", SDL_GetError());
+        return 3;
+    }
+    
+    Rasterizer rasterizer( surface );
+    rasterizer.setBlockSize( blockSize );
+    std::vector< double > best( capture.frames.size(), 1e30 );
+    std::vector< uint32_t > checksums( capture.frames.size() );
+    const double ticksPerMs = 0.001 * SDL_GetPerformanceFrequency();
+    
+    for ( int k = 0; k < repeat; k++ ) {
+        for ( std::size_t i = 0u; i < capture.frames.size(); i++ ) {
+            const Uint64 start = SDL_GetPerformanceCounter();
+            RenderFrame( rasterizer, surface, capture, capture.frames[i] );
+            const double ms = ( SDL_GetPerformanceCounter() - start ) / ticksPerMs;
+            best[i] = std::min( best[i], ms );
+            checksums[i] = Checksum( surface );
+        }
+    }
+    
+    double total = 0.0;
+    uint32_t checksum = 2166136261u;
+    for ( std::size_t i = 0u; i < capture.frames.size(); i++ ) {
+        printf("frame %4u: %8.3f ms  checksum %08x\n", unsigned( i ), best[i], checksums[i]);
+        total += best[i];
+        checksum = ( checksum ^ checksums[i] ) * 16777619u;
+    }
+    printf("%u frames, %u buffers: total %.3f ms, mean %.3f ms, checksum %08x\n", 
+        unsigned( capture.frames.size() ), unsigned( capture.buffers.size() ), 
+        total, capture.frames.empty() ? 0.0 : total / capture.frames.size(), checksum );
+    
+    const int failed = check ? CheckTraversal( capture, surface, blockSize ) : 0;
+    if ( check ) {
+        printf("traversal check: %d of %u frames differ\n", failed, unsigned( capture.frames.size() ));
+    }
+    SDL_FreeSurface( surface );
+    return failed ? 4 : 0;
+}
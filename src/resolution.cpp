@@ -0,0 +1,52 @@
+#include "resolution.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const float RiseRate = 0.5f;        // the weight of a frame slower than the average
+const float FallRate = 0.05f;       // the weight of a frame faster than the average
+const float GrowThreshold = 0.75f;  // the fraction of the budget the average must stay under to grow
+const float Step = 0.05f;           // scales are multiples of this
+
+}
+
+ResolutionController::ResolutionController( float budget, float minScale )
+:   Budget_( budget ),
+    MinScale_( std::min( std::max( minScale, Step ), 1.0f ) ),
+    scale_( 1.0f ),
+    average_( -1.0f ),
+    framesUnder_( 0 )
+    {}
+
+bool ResolutionController::update( float frameTime ) {
+    if ( average_ < 0.0f ) {
+        average_ = frameTime;
+    } else {
+        average_ += ( frameTime > average_ ? RiseRate : FallRate )*( frameTime - average_ );
+    }
+    framesUnder_ = average_ < GrowThreshold*Budget_ ? framesUnder_ + 1 : 0;
+
+    const float previous = scale_;
+    if ( average_ > Budget_ ) {
+        setScale_( std::floor( scale_*std::sqrt( Budget_ / average_ ) / Step )*Step );
+    } else if ( framesUnder_ > Cooldown ) {
+        setScale_( scale_ + Step );
+    }
+    if ( scale_ == previous ) {
+        return false;
+    }
+
+    /*
+     * the frames measured so far were rendered at the old scale, so the average
+     * is carried over to what the new scale is expected to cost
+     * */
+    const float ratio = scale_ / previous;
+    average_ *= ratio*ratio;
+    framesUnder_ = 0;
+    return true;
+}
+
+void ResolutionController::setScale_( float scale ) {
+    scale_ = std::min( std::max( scale, MinScale_ ), 1.0f );
+}
@@ -0,0 +1,51 @@
+#ifndef RESOLUTION_H
+#define RESOLUTION_H
+
+/**
+ * @class ResolutionController
+ * @file resolution.h
+ * @brief Chooses a render scale which keeps the frame time within a budget.
+ *
+ * The frame time is tracked as a moving average, which follows increases quickly and
+ * decreases slowly, so that a load spike is answered within a few frames. Over budget,
+ * the scale drops in proportion to the square root of the overrun, as the time spent
+ * filling pixels grows with the square of the scale. The scale only grows again, in small
+ * steps, once the average has stayed below a lower threshold for Cooldown frames in a row
+ * since the last change. The gap between the two thresholds keeps the scale from oscillating.
+ */
+class ResolutionController {
+    public:
+        /**
+         * @param budget the target frame time, in milliseconds
+         * @param minScale the lowest scale to render at
+         */
+        explicit ResolutionController( float budget, float minScale = 0.5f );
+
+        /**
+         * @brief Account for the time of the frame rendered at the current scale.
+         * @return true if the scale changed
+         */
+        bool update( float frameTime );
+
+        /**
+         * @brief The fraction of the full resolution to render at, along each axis.
+         */
+        float scale() const {
+            return scale_;
+        }
+
+    private:
+        enum {
+            Cooldown = 30   // the number of frames in a row under the lower threshold before the scale may grow
+        };
+
+        void setScale_( float scale );
+
+        const float Budget_;
+        const float MinScale_;
+        float scale_;
+        float average_;
+        int framesUnder_;   // frames in a row under the lower threshold, since the last change
+};
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+/*
+ * SSE2 is part of the x86-64 baseline, so it is used whenever the compiler
+ * targets it. Everything that uses it keeps a plain C++ fallback.
+ * */
+#if !defined(NO_SIMD) && ( defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 ) )
+#   define USE_SSE2
+#   include <emmintrin.h>
+#endif
+
+#endif
@@ -0,0 +1,423 @@
+#include "streaming.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+const char Magic[4] = { 'R', 'S', 'T', 'M' };
+const uint32_t Version = 1u;
+const long HeaderSize = 4 + 4 + 4 + 8;
+
+struct ChunkEntry {
+    float lo[3];
+    float hi[3];
+    uint64_t offset;
+    uint32_t vertices;
+};
+
+int Seek( FILE* file, uint64_t offset ) {
+#ifdef _MSC_VER
+    return _fseeki64( file, offset, SEEK_SET );
+#else
+    return fseeko( file, off_t( offset ), SEEK_SET );
+#endif
+}
+
+uint64_t Tell( FILE* file ) {
+#ifdef _MSC_VER
+    return _ftelli64( file );
+#else
+    return ftello( file );
+#endif
+}
+
+/*
+ * The cell is clamped before the conversion to int, which is undefined for values out
+ * of range. A flat mesh has a zero cell size along its flat axis, which makes the
+ * quotient infinite or NaN; NaN fails the first test, and goes to cell zero.
+ * */
+int Cell( float x, float lo, float size, int cells ) {
+    const float cell = ( x - lo ) / size;
+    if ( !( cell > 0.0f ) ) {
+        return 0;
+    }
+    return cell < float( cells - 1 ) ? int( cell ) : cells - 1;
+}
+
+}
+
+StreamingMeshBuilder::StreamingMeshBuilder( const Vector3f& lo, const Vector3f& hi, int cells, std::size_t memoryBudget )
+:   Lo_( lo ),
+    CellSize_( ( 1.0f / cells ) * ( hi - lo ) ),
+    Cells_( cells ),
+    MemoryBudget_( memoryBudget ),
+    pendingBytes_( 0u ),
+    pending_( cells*cells*cells ),
+    boundsLo_( cells*cells*cells, hi ),
+    boundsHi_( cells*cells*cells, lo ),
+    segments_(),
+    spillFile_( NULL ),
+    spillSize_( 0u ),
+    failed_( false )
+    {}
+
+StreamingMeshBuilder::~StreamingMeshBuilder() {
+    if ( spillFile_ ) {
+        fclose( spillFile_ );
+    }
+}
+
+void StreamingMeshBuilder::add( const std::vector< Vector4f >& triangles ) {
+    for ( std::size_t i = 0u; i + 2 < triangles.size(); i += 3 ) {
+        const Vector3f a( triangles[i] ), b( triangles[i+1] ), c( triangles[i+2] );
+        const Vector3f centroid = ( 1.0f / 3.0f ) * ( a + b + c );
+        const int cell = 
+            Cell( centroid.x, Lo_.x, CellSize_.x, Cells_ ) + Cells_*( 
+            Cell( centroid.y, Lo_.y, CellSize_.y, Cells_ ) + Cells_*
+            Cell( centroid.z, Lo_.z, CellSize_.z, Cells_ ) );
+        
+        pending_[cell].push_back( triangles[i] );
+        pending_[cell].push_back( triangles[i+1] );
+        pending_[cell].push_back( triangles[i+2] );
+        boundsLo_[cell] = Min( boundsLo_[cell], Min( a, Min( b, c ) ) );
+        boundsHi_[cell] = Max( boundsHi_[cell], Max( a, Max( b, c ) ) );
+        
+        pendingBytes_ += 3*sizeof( Vector4f );
+        if ( pendingBytes_ > MemoryBudget_ && !spill_() ) {
+            failed_ = true;
+        }
+    }
+}
+
+bool StreamingMeshBuilder::spill_() {
+    if ( !spillFile_ ) {
+        spillFile_ = tmpfile();
+        if ( !spillFile_ ) {
+            return false;
+        }
+    }
+    if ( Seek( spillFile_, spillSize_ ) != 0 ) {
+        return false;
+    }
+    for ( std::size_t cell = 0u; cell < pending_.size(); cell++ ) {
+        std::vector< Vector4f >& vertices = pending_[cell];
+        if ( vertices.empty() ) {
+            continue;
+        }
+        Segment segment;
+        segment.cell = cell;
+        segment.offset = spillSize_;
+        segment.vertices = vertices.size();
+        if ( fwrite( &vertices[0], sizeof( Vector4f ), vertices.size(), spillFile_ ) != vertices.size() ) {
+            return false;
+        }
+        segments_.push_back( segment );
+        spillSize_ += vertices.size() * sizeof( Vector4f );
+        std::vector< Vector4f >().swap( vertices );
+    }
+    pendingBytes_ = 0u;
+    return true;
+}
+
+bool StreamingMeshBuilder::write( const char* path ) {
+    if ( failed_ ) {
+        return false;
+    }
+    FILE* file = fopen( path, "wb" );
+    if ( !file ) {
+        return false;
+    }
+    
+    /*
+     * the header is written again once the chunk table is in place
+     * */
+    char header[HeaderSize] = { 0 };
+    bool ok = fwrite( header, HeaderSize, 1, file ) == 1;
+    
+    std::vector< std::vector< Segment > > cellSegments( pending_.size() );
+    for ( std::size_t i = 0u; i < segments_.size(); i++ ) {
+        cellSegments[segments_[i].cell].push_back( segments_[i] );
+    }
+    
+    std::vector< ChunkEntry > table;
+    std::vector< Vector4f > piece;
+    for ( std::size_t cell = 0u; ok && cell < pending_.size(); cell++ ) {
+        ChunkEntry entry;
+        entry.offset = Tell( file );
+        entry.vertices = 0u;
+        for ( std::size_t i = 0u; ok && i < cellSegments[cell].size(); i++ ) {
+            const Segment& segment = cellSegments[cell][i];
+            piece.resize( segment.vertices );
+            ok = Seek( spillFile_, segment.offset ) == 0 &&
+                 fread( &piece[0], sizeof( Vector4f ), piece.size(), spillFile_ ) == piece.size() &&
+                 fwrite( &piece[0], sizeof( Vector4f ), piece.size(), file ) == piece.size();
+            entry.vertices += segment.vertices;
+        }
+        const std::vector< Vector4f >& vertices = pending_[cell];
+        if ( ok && !vertices.empty() ) {
+            ok = fwrite( &vertices[0], sizeof( Vector4f ), vertices.size(), file ) == vertices.size();
+            entry.vertices += vertices.size();
+        }
+        if ( entry.vertices > 0u ) {
+            memcpy( entry.lo, boundsLo_[cell].data, sizeof( entry.lo ) );
+            memcpy( entry.hi, boundsHi_[cell].data, sizeof( entry.hi ) );
+            table.push_back( entry );
+        }
+    }
+    
+    const uint64_t tableOffset = Tell( file );
+    const uint32_t chunkCount = table.size();
+    for ( std::size_t i = 0u; ok && i < table.size(); i++ ) {
+        ok = fwrite( table[i].lo, sizeof( float ), 3, file ) == 3 &&
+             fwrite( table[i].hi, sizeof( float ), 3, file ) == 3 &&
+             fwrite( &table[i].offset, sizeof( uint64_t ), 1, file ) == 1 &&
+             fwrite( &table[i].vertices, sizeof( uint32_t ), 1, file ) == 1;
+    }
+    ok = ok && Seek( file, 0u ) == 0 &&
+         fwrite( Magic, 4, 1, file ) == 1 &&
+         fwrite( &Version, sizeof( Version ), 1, file ) == 1 &&
+         fwrite( &chunkCount, sizeof( chunkCount ), 1, file ) == 1 &&
+         fwrite( &tableOffset, sizeof( tableOffset ), 1, file ) == 1;
+    ok = fclose( file ) == 0 && ok;
+    return ok;
+}
+
+StreamingMesh::StreamingMesh( std::size_t memoryBudget )
+:   MemoryBudget_( memoryBudget ),
+    residentBytes_( 0u ),
+    loadingBytes_( 0u ),
+    frame_( 0u ),
+    chunks_(),
+    visible_(),
+    file_( NULL ),
+    thread_( NULL ),
+    mutex_( SDL_CreateMutex() ),
+    requested_( SDL_CreateCond() ),
+    requests_(),
+    loaded_(),
+    quit_( false )
+    {}
+
+StreamingMesh::~StreamingMesh() {
+    close();
+    SDL_DestroyCond( requested_ );
+    SDL_DestroyMutex( mutex_ );
+}
+
+bool StreamingMesh::open( const char* path ) {
+    close();
+    file_ = fopen( path, "rb" );
+    if ( !file_ ) {
+        return false;
+    }
+    
+    char magic[4];
+    uint32_t version, chunkCount;
+    uint64_t tableOffset;
+    bool ok = fread( magic, 4, 1, file_ ) == 1 && memcmp( magic, Magic, 4 ) == 0 &&
+              fread( &version, sizeof( version ), 1, file_ ) == 1 && version == Version &&
+              fread( &chunkCount, sizeof( chunkCount ), 1, file_ ) == 1 &&
+              fread( &tableOffset, sizeof( tableOffset ), 1, file_ ) == 1 &&
+              Seek( file_, tableOffset ) == 0;
+    
+    chunks_.resize( ok ? chunkCount : 0u );
+    for ( std::size_t i = 0u; ok && i < chunks_.size(); i++ ) {
+        Chunk& chunk = chunks_[i];
+        ok = fread( chunk.lo.data, sizeof( float ), 3, file_ ) == 3 &&
+             fread( chunk.hi.data, sizeof( float ), 3, file_ ) == 3 &&
+             fread( &chunk.offset, sizeof( uint64_t ), 1, file_ ) == 1 &&
+             fread( &chunk.vertices, sizeof( uint32_t ), 1, file_ ) == 1;
+        chunk.state = Unloaded;
+        chunk.lastVisible = 0u;
+    }
+    if ( !ok ) {
+        close();
+        return false;
+    }
+    
+    quit_ = false;
+    thread_ = SDL_CreateThread( loaderMain_, "StreamingMesh", this );
+    if ( !thread_ ) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void StreamingMesh::close() {
+    if ( thread_ ) {
+        SDL_LockMutex( mutex_ );
+        quit_ = true;
+        SDL_CondSignal( requested_ );
+        SDL_UnlockMutex( mutex_ );
+        SDL_WaitThread( thread_, NULL );
+        thread_ = NULL;
+    }
+    if ( file_ ) {
+        fclose( file_ );
+        file_ = NULL;
+    }
+    for ( std::size_t i = 0u; i < loaded_.size(); i++ ) {
+        delete loaded_[i].data;
+    }
+    loaded_.clear();
+    requests_.clear();
+    chunks_.clear();
+    visible_.clear();
+    residentBytes_ = 0u;
+    loadingBytes_ = 0u;
+}
+
+void StreamingMesh::update( const Matrix4f& model, const OrthoCamera& c ) {
+    frame_++;
+    
+    /*
+     * find the chunks in view, by the normalized device coordinate bounds of their
+     * bounding boxes, ordered by distance to the center of the near plane
+     * */
+    const Matrix4f transform = OrthoProjection( c ) * model;
+    std::vector< std::pair< float, int > > inView;
+    for ( std::size_t i = 0u; i < chunks_.size(); i++ ) {
+        const Chunk& chunk = chunks_[i];
+        Vector3f lo( 1e30f, 1e30f, 1e30f ), hi( -1e30f, -1e30f, -1e30f );
+        for ( int k = 0; k < 8; k++ ) {
+            const Vector3f p = transform * Vector4f( 
+                k & 1 ? chunk.hi.x : chunk.lo.x, 
+                k & 2 ? chunk.hi.y : chunk.lo.y, 
+                k & 4 ? chunk.hi.z : chunk.lo.z, 
+                1.0f 
+            );
+            lo = Min( lo, p );
+            hi = Max( hi, p );
+        }
+        if ( hi.x < -1.0f || lo.x > 1.0f || hi.y < -1.0f || lo.y > 1.0f || hi.z < -1.0f || lo.z > 1.0f ) {
+            continue;
+        }
+        const Vector3f nearest = Min( Max( Vector3f( 0.0f, 0.0f, -1.0f ), lo ), hi );
+        inView.push_back( std::make_pair( ( nearest - Vector3f( 0.0f, 0.0f, -1.0f ) ).squaredLength(), int( i ) ) );
+    }
+    std::sort( inView.begin(), inView.end() );
+    visible_.clear();
+    for ( std::size_t i = 0u; i < inView.size(); i++ ) {
+        visible_.push_back( inView[i].second );
+        chunks_[inView[i].second].lastVisible = frame_;
+    }
+    
+    SDL_LockMutex( mutex_ );
+    
+    /*
+     * take in the chunks loaded since the last update
+     * */
+    for ( std::size_t i = 0u; i < loaded_.size(); i++ ) {
+        Chunk& chunk = chunks_[loaded_[i].chunk];
+        chunk.data.swap( *loaded_[i].data );
+        delete loaded_[i].data;
+        loadingBytes_ -= bytes_( loaded_[i].chunk );
+        residentBytes_ += bytes_( loaded_[i].chunk );
+        chunk.state = Resident;
+    }
+    loaded_.clear();
+    
+    /*
+     * withdraw the requests the loader has not started on, and request again
+     * in the order of the current view
+     * */
+    for ( std::size_t i = 0u; i < requests_.size(); i++ ) {
+        chunks_[requests_[i]].state = Unloaded;
+        loadingBytes_ -= bytes_( requests_[i] );
+    }
+    requests_.clear();
+    for ( std::size_t i = 0u; i < visible_.size(); i++ ) {
+        const int id = visible_[i];
+        if ( chunks_[id].state != Unloaded || bytes_( id ) > MemoryBudget_ ) {
+            continue;
+        }
+        if ( !evict_( bytes_( id ) ) ) {
+            break;
+        }
+        chunks_[id].state = Requested;
+        loadingBytes_ += bytes_( id );
+        requests_.push_back( id );
+    }
+    if ( !requests_.empty() ) {
+        SDL_CondSignal( requested_ );
+    }
+    
+    SDL_UnlockMutex( mutex_ );
+}
+
+void StreamingMesh::render( Rasterizer& r, const Matrix4f& model, const OrthoCamera& c ) const {
+    for ( std::size_t i = 0u; i < visible_.size(); i++ ) {
+        const Chunk& chunk = chunks_[visible_[i]];
+        if ( chunk.state == Resident ) {
+            Render( r, chunk.data, model, c );
+        }
+    }
+}
+
+std::size_t StreamingMesh::residentBytes() const {
+    return residentBytes_;
+}
+
+int StreamingMesh::loaderMain_( void* mesh ) {
+    static_cast< StreamingMesh* >( mesh )->load_();
+    return 0;
+}
+
+void StreamingMesh::load_() {
+    SDL_LockMutex( mutex_ );
+    for ( ;; ) {
+        while ( requests_.empty() && !quit_ ) {
+            SDL_CondWait( requested_, mutex_ );
+        }
+        if ( quit_ ) {
+            break;
+        }
+        Load load;
+        load.chunk = requests_.front();
+        requests_.pop_front();
+        SDL_UnlockMutex( mutex_ );
+        
+        /*
+         * chunks which fail to read are taken in empty
+         * */
+        const Chunk& chunk = chunks_[load.chunk];
+        load.data = new std::vector< Vector4f >( chunk.vertices );
+        if ( chunk.vertices > 0u && ( Seek( file_, chunk.offset ) != 0 || 
+             fread( &( *load.data )[0], sizeof( Vector4f ), chunk.vertices, file_ ) != chunk.vertices ) ) {
+            load.data->clear();
+        }
+        
+        SDL_LockMutex( mutex_ );
+        loaded_.push_back( load );
+    }
+    SDL_UnlockMutex( mutex_ );
+}
+
+std::size_t StreamingMesh::bytes_( int chunk ) const {
+    return chunks_[chunk].vertices * sizeof( Vector4f );
+}
+
+/*
+ * evict the least recently visible chunks until the bytes fit in the budget. Chunks in
+ * view this frame are not evicted.
+ * */
+bool StreamingMesh::evict_( std::size_t bytes ) {
+    while ( residentBytes_ + loadingBytes_ + bytes > MemoryBudget_ ) {
+        int oldest = -1;
+        for ( std::size_t i = 0u; i < chunks_.size(); i++ ) {
+            const Chunk& chunk = chunks_[i];
+            if ( chunk.state == Resident && chunk.lastVisible != frame_ && 
+                 ( oldest < 0 || chunk.lastVisible < chunks_[oldest].lastVisible ) ) {
+                oldest = i;
+            }
+        }
+        if ( oldest < 0 ) {
+            return false;
+        }
+        std::vector< Vector4f >().swap( chunks_[oldest].data );
+        chunks_[oldest].state = Unloaded;
+        residentBytes_ -= bytes_( oldest );
+    }
+    return true;
+}
@@ -0,0 +1,168 @@
+#ifndef STREAMING_H
+#define STREAMING_H
+
+#ifdef _MSC_VER
+#   include <SDL_thread.h>
+#   include <SDL_mutex.h>
+#else
+#   include <SDL2/SDL_thread.h>
+#   include <SDL2/SDL_mutex.h>
+#endif
+#include "rasterizer.h"
+#include "renderer.h"
+#include "vector.h"
+#include "matrix.h"
+#include "int.h"
+#include <cstdio>
+#include <deque>
+#include <vector>
+
+/*
+ * Streaming mesh file layout. All values are stored in the byte order of the 
+ * writing machine.
+ * 
+ * header:      "RSTM", uint32 version, uint32 chunk count, uint64 chunk table offset
+ * chunk data:  vertex count * 4 floats per chunk, a triangle list
+ * chunk table: per chunk, 3 floats bounds min, 3 floats bounds max, uint64 data offset, 
+ *              uint32 vertex count
+ * */
+
+/**
+ * @class StreamingMeshBuilder
+ * @file streaming.h
+ * @brief Splits a triangle list into the spatial chunks of a streaming mesh file.
+ * 
+ * Triangles can be added in any number of batches. Each triangle goes to the grid cell
+ * containing its centroid. Triangles waiting to be written are spilled to a temporary
+ * file whenever they exceed the memory budget, so the input does not have to fit in
+ * memory.
+ */
+class StreamingMeshBuilder {
+    public:
+        /**
+         * @param lo the minimum corner of the grid
+         * @param hi the maximum corner of the grid
+         * @param cells the number of cells along each axis
+         * @param memoryBudget the number of bytes of triangles held in memory before spilling
+         */
+        StreamingMeshBuilder( const Vector3f& lo, const Vector3f& hi, int cells, std::size_t memoryBudget );
+        ~StreamingMeshBuilder();
+        
+        void add( const std::vector< Vector4f >& triangles );
+        
+        /**
+         * @brief Write the chunks to the streaming mesh file.
+         * @return false if a file could not be written or read
+         */
+        bool write( const char* path );
+        
+    private:
+        StreamingMeshBuilder( const StreamingMeshBuilder& );
+        StreamingMeshBuilder& operator=( const StreamingMeshBuilder& );
+        
+        struct Segment {
+            int cell;
+            uint64_t offset;
+            uint32_t vertices;
+        };
+        
+        bool spill_();
+        
+        const Vector3f Lo_;
+        const Vector3f CellSize_;
+        const int Cells_;
+        const std::size_t MemoryBudget_;
+        std::size_t pendingBytes_;
+        std::vector< std::vector< Vector4f > > pending_;    // per cell
+        std::vector< Vector3f > boundsLo_, boundsHi_;       // per cell
+        std::vector< Segment > segments_;
+        FILE* spillFile_;
+        uint64_t spillSize_;
+        bool failed_;
+};
+
+/**
+ * @class StreamingMesh
+ * @file streaming.h
+ * @brief Renders a streaming mesh file with a hard cap on the memory used for its geometry.
+ * 
+ * Chunks are read by a background thread into a cache, which evicts the least recently
+ * visible chunks to stay within the budget. The chunks requested each update are those
+ * in view, nearest to the center of the near plane first. Rendering draws whatever is
+ * resident.
+ */
+class StreamingMesh {
+    public:
+        /**
+         * @param memoryBudget the maximum number of bytes of resident and loading chunks
+         */
+        explicit StreamingMesh( std::size_t memoryBudget );
+        ~StreamingMesh();
+        
+        /**
+         * @brief Open a streaming mesh file, and start the loader thread.
+         * @return false if the file could not be read
+         */
+        bool open( const char* path );
+        
+        void close();
+        
+        /**
+         * @brief Take in the chunks loaded since the last update, and request the chunks 
+         * in view which are not resident. Call once per frame, before render().
+         */
+        void update( const Matrix4f& model, const OrthoCamera& );
+        
+        /**
+         * @brief Render the resident chunks which were in view at the last update.
+         */
+        void render( Rasterizer&, const Matrix4f& model, const OrthoCamera& ) const;
+        
+        std::size_t residentBytes() const;
+        
+    private:
+        StreamingMesh( const StreamingMesh& );
+        StreamingMesh& operator=( const StreamingMesh& );
+        
+        enum ChunkState {
+            Unloaded,
+            Requested,      // queued or being read by the loader thread
+            Resident
+        };
+        
+        struct Chunk {
+            Vector3f lo, hi;
+            uint64_t offset;
+            uint32_t vertices;
+            ChunkState state;               // used by the main thread only
+            unsigned int lastVisible;       // the frame the chunk was last in view
+            std::vector< Vector4f > data;
+        };
+        
+        struct Load {
+            int chunk;
+            std::vector< Vector4f >* data;
+        };
+        
+        static int loaderMain_( void* );
+        void load_();
+        std::size_t bytes_( int chunk ) const;
+        bool evict_( std::size_t bytes );
+        
+        const std::size_t MemoryBudget_;
+        std::size_t residentBytes_;
+        std::size_t loadingBytes_;
+        unsigned int frame_;
+        std::vector< Chunk > chunks_;
+        std::vector< int > visible_;
+        
+        FILE* file_;                        // read by the loader thread only
+        SDL_Thread* thread_;
+        SDL_mutex* mutex_;
+        SDL_cond* requested_;
+        std::deque< int > requests_;        // guarded by mutex_
+        std::vector< Load > loaded_;        // guarded by mutex_
+        bool quit_;                         // guarded by mutex_
+};
+
+#endif
@@ -0,0 +1,171 @@
+#include "trace.h"
+#include <cstdio>
+
+#ifdef ENABLE_TRACE
+
+#include <vector>
+#include <algorithm>
+
+TRACE_THREAD_LOCAL TraceBuffer* ThreadTraceBuffer = NULL;
+
+namespace {
+
+enum {
+    FrameCapacity = 1024    // a power of two
+};
+
+SDL_SpinLock registryLock = 0;
+std::vector< TraceBuffer* > buffers;   // never freed, their events are written out at the end
+std::vector< TraceBuffer* > released;  // buffers of threads which have exited
+
+/*
+ * The time stamp counter is converted to wall time by comparing it to the SDL
+ * performance counter over the time since the first buffer was registered.
+ * */
+uint64_t originTicks = 0u;
+uint64_t originCounter = 0u;
+
+uint64_t frames[FrameCapacity];
+uint32_t frameCount = 0u;
+
+}
+
+TraceBuffer* RegisterTraceThread() {
+    TraceBuffer* buffer = NULL;
+    SDL_AtomicLock( &registryLock );
+    if ( buffers.empty() ) {
+        originTicks = TraceNow();
+        originCounter = SDL_GetPerformanceCounter();
+    }
+    if ( !released.empty() ) {
+        buffer = released.back();
+        released.pop_back();
+    }
+    SDL_AtomicUnlock( &registryLock );
+
+    if ( !buffer ) {
+        buffer = new TraceBuffer();
+        buffer->head = 0u;
+        SDL_AtomicLock( &registryLock );
+        buffer->thread = int( buffers.size() ) + 1;
+        buffers.push_back( buffer );
+        SDL_AtomicUnlock( &registryLock );
+    }
+    ThreadTraceBuffer = buffer;
+    return buffer;
+}
+
+void TraceFrame() {
+    if ( !ThreadTraceBuffer ) {
+        RegisterTraceThread();
+    }
+    frames[frameCount & ( FrameCapacity - 1 )] = TraceNow();
+    frameCount++;
+}
+
+void TraceThreadExit() {
+    if ( !ThreadTraceBuffer ) {
+        return;
+    }
+    SDL_AtomicLock( &registryLock );
+    released.push_back( ThreadTraceBuffer );
+    SDL_AtomicUnlock( &registryLock );
+    ThreadTraceBuffer = NULL;
+}
+
+bool WriteTrace( const char* path, int count, int& written ) {
+    written = 0;
+    if ( frameCount == 0u || count <= 0 ) {
+        return false;
+    }
+    const uint64_t now = TraceNow();
+    const uint64_t counter = SDL_GetPerformanceCounter();
+
+    SDL_AtomicLock( &registryLock );
+    const std::vector< TraceBuffer* > threads( buffers );
+    SDL_AtomicUnlock( &registryLock );
+    std::vector< uint32_t > heads( threads.size() );
+    for ( std::size_t i = 0u; i < threads.size(); i++ ) {
+        heads[i] = threads[i]->head;
+    }
+    SDL_MemoryBarrierAcquire();
+
+    /*
+     * Events are written as their scopes end, so a full ring has dropped only events
+     * which ended before its oldest one did. Frames which started before that may be
+     * missing events, and are left out.
+     * */
+    uint64_t lostUntil = 0u;
+    for ( std::size_t i = 0u; i < threads.size(); i++ ) {
+        if ( heads[i] > uint32_t( TraceBuffer::Capacity ) ) {
+            const TraceEvent& oldest = threads[i]->events[heads[i] & ( TraceBuffer::Capacity - 1 )];
+            lostUntil = std::max( lostUntil, oldest.end );
+        }
+    }
+
+    /*
+     * the trace starts at the first of the last frames which are still complete
+     * */
+    uint32_t firstFrame = frameCount - std::min( uint32_t( count ), std::min( frameCount, uint32_t( FrameCapacity ) ) );
+    while ( firstFrame < frameCount && frames[firstFrame & ( FrameCapacity - 1 )] < lostUntil ) {
+        firstFrame++;
+    }
+    if ( firstFrame == frameCount ) {
+        return false;
+    }
+    const uint64_t first = frames[firstFrame & ( FrameCapacity - 1 )];
+
+    double ticksPerUs = 1.0;
+    if ( now > originTicks && counter > originCounter ) {
+        ticksPerUs = double( now - originTicks ) / ( double( counter - originCounter )*1000000.0 / SDL_GetPerformanceFrequency() );
+    }
+
+    FILE* file = fopen( path, "w" );
+    if ( !file ) {
+        return false;
+    }
+    fprintf( file, "{\"traceEvents\":[\n" );
+
+    for ( std::size_t i = 0u; i < threads.size(); i++ ) {
+        const TraceBuffer& buffer = *threads[i];
+        fprintf( file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+            i > 0u ? ",\n" : "", buffer.thread, buffer.thread );
+
+        const uint32_t head = heads[i];
+        const uint32_t tail = head > uint32_t( TraceBuffer::Capacity ) ? head - TraceBuffer::Capacity : 0u;
+        for ( uint32_t e = tail; e < head; e++ ) {
+            const TraceEvent& event = buffer.events[e & ( TraceBuffer::Capacity - 1 )];
+            if ( event.start < first ) {
+                continue;
+            }
+            fprintf( file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                event.name, double( event.start - first ) / ticksPerUs,
+                double( event.end - event.start ) / ticksPerUs, buffer.thread );
+        }
+    }
+
+    /*
+     * frame boundaries, as instant events across all threads
+     * */
+    for ( uint32_t f = firstFrame; f < frameCount; f++ ) {
+        fprintf( file, ",\n{\"name\":\"frame %u\",\"ph\":\"i\",\"s\":\"g\",\"ts\":%.3f,\"pid\":1,\"tid\":1}",
+            f, double( frames[f & ( FrameCapacity - 1 )] - first ) / ticksPerUs );
+    }
+
+    fprintf( file, "\n],\"displayTimeUnit\":\"ms\"}\n" );
+    const bool ok = !ferror( file );
+    fclose( file );
+    if ( ok ) {
+        written = int( frameCount - firstFrame );
+    }
+    return ok;
+}
+
+#else
+
+bool WriteTrace( const char*, int, int& written ) {
+    written = 0;
+    return false;
+}
+
+#endif
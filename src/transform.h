@@ -0,0 +1,127 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "vector.h"
+#include "matrix.h"
+#include "simd.h"
+#include "int.h"
+#include <cstdlib>
+
+/*
+ * Batched matrix and vertex transforms, shared by the draw functions.
+ * */
+
+#ifdef USE_SSE2
+/*
+ * the product of a matrix and a vertex is a linear combination of the matrix 
+ * columns c0...c3, weighted by the vertex components
+ * */
+inline __m128 Transform( __m128 c0, __m128 c1, __m128 c2, __m128 c3, __m128 v ) {
+    __m128 acc = _mm_mul_ps( c0, _mm_shuffle_ps( v, v, _MM_SHUFFLE( 0, 0, 0, 0 ) ) );
+    acc = _mm_add_ps( acc, _mm_mul_ps( c1, _mm_shuffle_ps( v, v, _MM_SHUFFLE( 1, 1, 1, 1 ) ) ) );
+    acc = _mm_add_ps( acc, _mm_mul_ps( c2, _mm_shuffle_ps( v, v, _MM_SHUFFLE( 2, 2, 2, 2 ) ) ) );
+    acc = _mm_add_ps( acc, _mm_mul_ps( c3, _mm_shuffle_ps( v, v, _MM_SHUFFLE( 3, 3, 3, 3 ) ) ) );
+    return acc;
+}
+#endif
+
+/*
+ * out[i] = lhs * rhs[i], for every matrix in rhs.
+ * 
+ * Row r of the product is a linear combination of the rows of rhs[i], 
+ * weighted by row r of lhs.
+ * */
+inline void ComposeMatrices( const Matrix4f& lhs, const Matrix4f* rhs, Matrix4f* out, std::size_t count ) {
+#ifdef USE_SSE2
+    __m128 l[16];
+    for ( int k = 0; k < 16; k++ ) {
+        l[k] = _mm_set1_ps( lhs.data[k] );
+    }
+    for ( std::size_t i = 0u; i < count; i++ ) {
+        const __m128 r0 = _mm_loadu_ps( rhs[i].data );
+        const __m128 r1 = _mm_loadu_ps( rhs[i].data + 4 );
+        const __m128 r2 = _mm_loadu_ps( rhs[i].data + 8 );
+        const __m128 r3 = _mm_loadu_ps( rhs[i].data + 12 );
+        for ( int row = 0; row < 4; row++ ) {
+            __m128 acc = _mm_mul_ps( l[4*row], r0 );
+            acc = _mm_add_ps( acc, _mm_mul_ps( l[4*row+1], r1 ) );
+            acc = _mm_add_ps( acc, _mm_mul_ps( l[4*row+2], r2 ) );
+            acc = _mm_add_ps( acc, _mm_mul_ps( l[4*row+3], r3 ) );
+            _mm_storeu_ps( out[i].data + 4*row, acc );
+        }
+    }
+#else
+    for ( std::size_t i = 0u; i < count; i++ ) {
+        out[i] = lhs * rhs[i];
+    }
+#endif
+}
+
+/*
+ * out[i] = m * in[i], for every vertex in the buffer.
+ * */
+inline void TransformVertices( const Matrix4f& m, const Vector4f* in, Vector4f* out, std::size_t count ) {
+#ifdef USE_SSE2
+    const __m128 c0 = _mm_setr_ps( m.data[0], m.data[4], m.data[8], m.data[12] );
+    const __m128 c1 = _mm_setr_ps( m.data[1], m.data[5], m.data[9], m.data[13] );
+    const __m128 c2 = _mm_setr_ps( m.data[2], m.data[6], m.data[10], m.data[14] );
+    const __m128 c3 = _mm_setr_ps( m.data[3], m.data[7], m.data[11], m.data[15] );
+    for ( std::size_t i = 0u; i < count; i++ ) {
+        _mm_storeu_ps( out[i].data, Transform( c0, c1, c2, c3, _mm_loadu_ps( in[i].data ) ) );
+    }
+#else
+    for ( std::size_t i = 0u; i < count; i++ ) {
+        out[i] = m * in[i];
+    }
+#endif
+}
+
+/*
+ * out[v*count + i] = m[v] * in[i], for every view matrix and vertex.
+ * 
+ * The vertices are transformed in tiles small enough to stay in the cache, so that the
+ * buffer is read from memory once for all of the views.
+ * */
+inline void TransformViews( const Matrix4f* m, std::size_t views, const Vector4f* in, Vector4f* out, std::size_t count ) {
+    const std::size_t TileSize = 256u;
+    for ( std::size_t first = 0u; first < count; first += TileSize ) {
+        const std::size_t n = count - first < TileSize ? count - first : TileSize;
+        for ( std::size_t v = 0u; v < views; v++ ) {
+            TransformVertices( m[v], in + first, out + v*count + first, n );
+        }
+    }
+}
+
+/*
+ * out[i] = m * in[i], for every vertex of a quantized buffer. Each vertex is four 
+ * unsigned 16 bit integers, which are converted to floating point as they are loaded.
+ * Dequantization is done by m.
+ * */
+inline void TransformQuantized( const Matrix4f& m, const uint16_t* in, Vector4f* out, std::size_t count ) {
+#ifdef USE_SSE2
+    const __m128 c0 = _mm_setr_ps( m.data[0], m.data[4], m.data[8], m.data[12] );
+    const __m128 c1 = _mm_setr_ps( m.data[1], m.data[5], m.data[9], m.data[13] );
+    const __m128 c2 = _mm_setr_ps( m.data[2], m.data[6], m.data[10], m.data[14] );
+    const __m128 c3 = _mm_setr_ps( m.data[3], m.data[7], m.data[11], m.data[15] );
+    const __m128i zero = _mm_setzero_si128();
+    std::size_t i = 0u;
+    for ( ; i + 1 < count; i += 2 ) {
+        const __m128i q = _mm_loadu_si128( ( const __m128i* )( in + 4*i ) );
+        const __m128 v0 = _mm_cvtepi32_ps( _mm_unpacklo_epi16( q, zero ) );
+        const __m128 v1 = _mm_cvtepi32_ps( _mm_unpackhi_epi16( q, zero ) );
+        _mm_storeu_ps( out[i].data, Transform( c0, c1, c2, c3, v0 ) );
+        _mm_storeu_ps( out[i+1].data, Transform( c0, c1, c2, c3, v1 ) );
+    }
+    if ( i < count ) {
+        const __m128i q = _mm_loadl_epi64( ( const __m128i* )( in + 4*i ) );
+        const __m128 v = _mm_cvtepi32_ps( _mm_unpacklo_epi16( q, zero ) );
+        _mm_storeu_ps( out[i].data, Transform( c0, c1, c2, c3, v ) );
+    }
+#else
+    for ( std::size_t i = 0u; i < count; i++ ) {
+        out[i] = m * Vector4f( in[4*i], in[4*i+1], in[4*i+2], in[4*i+3] );
+    }
+#endif
+}
+
+#endif
@@ -0,0 +1,136 @@
+#include "upscale.h"
+#include "simd.h"
+#include "assert.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+/*
+ * The position of a destination pixel center in the source, as the first of the two
+ * source pixels it lies between, and the 7 bit weight of the second one.
+ * */
+void Sample( int i, int from, int to, int& first, int& weight ) {
+    const float s = std::max( ( i + 0.5f )*from / to - 0.5f, 0.0f );
+    first = std::min( int( s ), from - 1 );
+    weight = first == from - 1 ? 0 : int( ( s - first )*128.0f + 0.5f );
+}
+
+/*
+ * the weights of the two pixels, as the pair of 16 bit integers that _mm_madd_epi16 expects
+ * */
+inline int32_t Weights( int weight ) {
+    return ( weight << 16 ) | ( 128 - weight );
+}
+
+inline uint32_t Lerp( uint32_t a, uint32_t b, int weight ) {
+    uint32_t r = 0u;
+    for ( int shift = 0; shift < 32; shift += 8 ) {
+        const uint32_t ca = ( a >> shift ) & 0xffu;
+        const uint32_t cb = ( b >> shift ) & 0xffu;
+        r |= ( ( ca*( 128 - weight ) + cb*weight + 64 ) >> 7 ) << shift;
+    }
+    return r;
+}
+
+#ifdef USE_SSE2
+/*
+ * Interleave the bytes of the pixels of a and b, so that each channel of a is next to
+ * the same channel of b, and let _mm_madd_epi16 do the weighted sum of each pair.
+ * w0...w3 are the weights of the four pixels.
+ * */
+inline __m128i Lerp4( __m128i a, __m128i b, __m128i w0, __m128i w1, __m128i w2, __m128i w3 ) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32( 64 );
+    const __m128i lo = _mm_unpacklo_epi8( a, b );
+    const __m128i hi = _mm_unpackhi_epi8( a, b );
+    const __m128i p0 = _mm_srli_epi32( _mm_add_epi32( _mm_madd_epi16( _mm_unpacklo_epi8( lo, zero ), w0 ), round ), 7 );
+    const __m128i p1 = _mm_srli_epi32( _mm_add_epi32( _mm_madd_epi16( _mm_unpackhi_epi8( lo, zero ), w1 ), round ), 7 );
+    const __m128i p2 = _mm_srli_epi32( _mm_add_epi32( _mm_madd_epi16( _mm_unpacklo_epi8( hi, zero ), w2 ), round ), 7 );
+    const __m128i p3 = _mm_srli_epi32( _mm_add_epi32( _mm_madd_epi16( _mm_unpackhi_epi8( hi, zero ), w3 ), round ), 7 );
+    return _mm_packus_epi16( _mm_packs_epi32( p0, p1 ), _mm_packs_epi32( p2, p3 ) );
+}
+#endif
+
+}
+
+void Upscale( SDL_Surface* surface, int width, int height, std::vector< uint32_t >& scratch ) {
+    ASSERT( surface->format->BytesPerPixel == 4, "Upscaling needs 32 bit pixels" );
+    ASSERT( width > 0 && width <= surface->w && height > 0 && height <= surface->h, "Source does not fit the surface" );
+    const int W = surface->w;
+    const int H = surface->h;
+
+    /*
+     * the source is read from a copy, as the destination overlaps it. The copy has room
+     * for one more row, which holds the vertically filtered row being scaled.
+     * */
+    scratch.resize( width*( height + 1 ) );
+    for ( int i = 0; i < height; i++ ) {
+        const uint32_t* row = ( const uint32_t* )( ( const unsigned char* ) surface->pixels + i*surface->pitch );
+        std::copy( row, row + width, &scratch[i*width] );
+    }
+    uint32_t* filtered = &scratch[height*width];
+
+    std::vector< int > columns( W );
+    std::vector< int32_t > columnWeights( W );
+    for ( int j = 0; j < W; j++ ) {
+        int weight;
+        Sample( j, width, W, columns[j], weight );
+        columnWeights[j] = Weights( weight );
+    }
+
+    int filteredRow = -1, filteredWeight = -1;
+    for ( int i = 0; i < H; i++ ) {
+        int first, weight;
+        Sample( i, height, H, first, weight );
+        const uint32_t* a = &scratch[first*width];
+        const uint32_t* b = &scratch[std::min( first + 1, height - 1 )*width];
+
+        /*
+         * filter vertically, unless the previous row used the same source rows and weight
+         * */
+        if ( first != filteredRow || weight != filteredWeight ) {
+            int j = 0;
+#ifdef USE_SSE2
+            const __m128i w = _mm_set1_epi32( Weights( weight ) );
+            for ( ; j + 3 < width; j += 4 ) {
+                const __m128i pa = _mm_loadu_si128( ( const __m128i* )( a + j ) );
+                const __m128i pb = _mm_loadu_si128( ( const __m128i* )( b + j ) );
+                _mm_storeu_si128( ( __m128i* )( filtered + j ), Lerp4( pa, pb, w, w, w, w ) );
+            }
+#endif
+            for ( ; j < width; j++ ) {
+                filtered[j] = Lerp( a[j], b[j], weight );
+            }
+            filteredRow = first;
+            filteredWeight = weight;
+        }
+
+        /*
+         * and then horizontally, into the destination row
+         * */
+        uint32_t* out = ( uint32_t* )( ( unsigned char* ) surface->pixels + i*surface->pitch );
+        int j = 0;
+#ifdef USE_SSE2
+        for ( ; j + 3 < W; j += 4 ) {
+            const int* c = &columns[j];
+            const int last = width - 1;
+            const __m128i pa = _mm_setr_epi32(
+                filtered[c[0]], filtered[c[1]], filtered[c[2]], filtered[c[3]]
+            );
+            const __m128i pb = _mm_setr_epi32(
+                filtered[std::min( c[0] + 1, last )], filtered[std::min( c[1] + 1, last )],
+                filtered[std::min( c[2] + 1, last )], filtered[std::min( c[3] + 1, last )]
+            );
+            _mm_storeu_si128( ( __m128i* )( out + j ), Lerp4( pa, pb,
+                _mm_set1_epi32( columnWeights[j] ), _mm_set1_epi32( columnWeights[j+1] ),
+                _mm_set1_epi32( columnWeights[j+2] ), _mm_set1_epi32( columnWeights[j+3] )
+            ) );
+        }
+#endif
+        for ( ; j < W; j++ ) {
+            const int c = columns[j];
+            out[j] = Lerp( filtered[c], filtered[std::min( c + 1, width - 1 )], columnWeights[j] >> 16 );
+        }
+    }
+}
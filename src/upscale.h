@@ -0,0 +1,18 @@
+#ifndef UPSCALE_H
+#define UPSCALE_H
+
+#include <SDL2/SDL_surface.h>
+#include "int.h"
+#include <vector>
+
+/**
+ * @brief Scale the top left width x height pixels of a 32 bit surface up to fill the
+ * whole surface, with bilinear filtering.
+ *
+ * The filter weights are 7 bit fixed point, and the SSE2 and plain versions give
+ * identical results.
+ * @param scratch holds a copy of the source pixels, reused between calls
+ */
+void Upscale( SDL_Surface*, int width, int height, std::vector< uint32_t >& scratch );
+
+#endif
@@ -146,6 +146,27 @@ Vector4<T> operator*( T scale, const Vector4<T>& rhs ) {
     );
 }
 
+/*
+ * the component-wise minimum and maximum, for growing bounding boxes
+ * */
+template<typename T>
+Vector3<T> Min( const Vector3<T>& a, const Vector3<T>& b ) {
+    return Vector3<T>(
+        b.x < a.x ? b.x : a.x,
+        b.y < a.y ? b.y : a.y,
+        b.z < a.z ? b.z : a.z
+    );
+}
+
+template<typename T>
+Vector3<T> Max( const Vector3<T>& a, const Vector3<T>& b ) {
+    return Vector3<T>(
+        a.x < b.x ? b.x : a.x,
+        a.y < b.y ? b.y : a.y,
+        a.z < b.z ? b.z : a.z
+    );
+}
+
 typedef Vector2<float> Vector2f;
 typedef Vector3<float> Vector3f;
 typedef Vector4<float> Vector4f;